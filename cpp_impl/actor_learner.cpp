@@ -0,0 +1,153 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "agent.hpp"
+#include "board.hpp"
+#include "episode.hpp"
+#include "queue.hpp"
+
+// Self-play and training in one process: actor threads play nega_player
+// against itself and push finished episodes into a lock-free queue, the
+// learner thread pops them and applies TD(0) updates to its own copy of the
+// net, and every `publish` episodes it hands the actors a new read-only
+// snapshot. Actors pick the snapshot up between episodes by swapping a
+// shared_ptr, so neither side ever waits for the other.
+using Net = nega_player::Net;
+
+int main(int argc, const char* argv[]) {
+  std::srand(std::time(nullptr));
+  std::copy(argv, argv + argc,
+            std::ostream_iterator<const char*>(std::cout, " "));
+  std::cout << std::endl;
+  int actors = std::max(2u, std::thread::hardware_concurrency()) - 1;
+  int depth = 1;
+  int seconds = 60;
+  size_t publish = 64;
+  Board::Reward lr = 0.0001;
+  std::string model_path = "model/3_8_newNet.model";
+  std::string save_path = "";
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto match_arg = [&](std::string flag) -> bool {
+      auto it = arg.find_first_not_of('-');
+      return arg.find(flag, it) == it;
+    };
+    auto next_opt = [&]() -> std::string {
+      auto it = arg.find('=') + 1;
+      return it ? arg.substr(it) : argv[++i];
+    };
+    if (match_arg("actors")) {
+      actors = std::max(1, std::stoi(next_opt()));
+    } else if (match_arg("depth")) {
+      depth = std::stoi(next_opt());
+    } else if (match_arg("seconds")) {
+      seconds = std::stoi(next_opt());
+    } else if (match_arg("publish")) {
+      publish = std::max(1ull, std::stoull(next_opt()));
+    } else if (match_arg("lr")) {
+      lr = std::stof(next_opt());
+    } else if (match_arg("model")) {
+      model_path = next_opt();
+    } else if (match_arg("save")) {
+      save_path = next_opt();
+    }
+  }
+  if (save_path.empty()) save_path = model_path;
+
+  Net net(model_path);
+  std::atomic<std::shared_ptr<const Net>> snapshot{
+      std::make_shared<const Net>(net)};
+  BoundedQueue<Episode> queue(1024);
+  std::atomic<bool> stop = false;
+  std::atomic<uint64_t> episodes_played = 0;
+  std::atomic<uint64_t> episodes_learned = 0;
+  std::atomic<uint64_t> learner_steps = 0;
+  std::atomic<uint64_t> snapshots = 0;
+
+  auto actor = [&]() {
+    nega_player p1(depth), p2(depth);
+    std::shared_ptr<const Net> current;
+    int first = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+      auto latest = snapshot.load(std::memory_order_acquire);
+      if (latest != current) {
+        current = latest;
+        for (auto* p : {&p1, &p2}) {
+          p->net = current;
+          p->eval_cache->clear();
+        }
+      }
+      Episode ep = PlayAnEpisode(p1, p2, first);
+      first ^= 1;
+      episodes_played.fetch_add(1, std::memory_order_relaxed);
+      // a full queue means the learner is behind, wait rather than drop
+      while (!queue.try_push(std::move(ep))) {
+        if (stop.load(std::memory_order_relaxed)) return;
+        std::this_thread::yield();
+      }
+    }
+  };
+
+  auto learner = [&]() {
+    Episode ep;
+    while (!stop.load(std::memory_order_relaxed)) {
+      if (!queue.try_pop(ep)) {
+        std::this_thread::yield();
+        continue;
+      }
+      td_episode(net, ep, [&](const Board& b, Board::Reward error) {
+        net.update_net(b, error, lr);
+      });
+      learner_steps.fetch_add(ep.history.size() + 1,
+                              std::memory_order_relaxed);
+      if (episodes_learned.fetch_add(1, std::memory_order_relaxed) % publish ==
+          publish - 1) {
+        snapshot.store(std::make_shared<const Net>(net),
+                       std::memory_order_release);
+        snapshots.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (int i = 0; i < actors; i++) pool.emplace_back(actor);
+  std::thread learner_thread(learner);
+
+  using clock = std::chrono::steady_clock;
+  const auto start = clock::now();
+  auto last = start;
+  uint64_t last_played = 0, last_steps = 0;
+  while (clock::now() - start < std::chrono::seconds(seconds)) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    const auto now = clock::now();
+    const double dt = std::chrono::duration<double>(now - last).count();
+    const uint64_t played = episodes_played.load();
+    const uint64_t steps = learner_steps.load();
+    std::cout.precision(4);
+    std::cout << "[" << std::chrono::duration<double>(now - start).count()
+              << "s] episodes/sec: " << (played - last_played) / dt
+              << " | learner steps/sec: " << (steps - last_steps) / dt
+              << " | learned: " << episodes_learned.load()
+              << " | snapshots: " << snapshots.load() << std::endl;
+    last = now;
+    last_played = played;
+    last_steps = steps;
+  }
+  stop = true;
+  for (auto& t : pool) t.join();
+  learner_thread.join();
+
+  const double total =
+      std::chrono::duration<double>(clock::now() - start).count();
+  std::cout << "Total: " << episodes_played.load() << " episodes played, "
+            << episodes_learned.load() << " learned, "
+            << episodes_played.load() / total << " episodes/sec, "
+            << learner_steps.load() / total << " learner steps/sec"
+            << std::endl;
+  net.save(save_path);
+}
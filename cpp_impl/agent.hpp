@@ -12,19 +12,35 @@
 #include <vector>
 
 #include "board.hpp"
+#include "eval_cache.hpp"
 #include "mcts.hpp"
+#include "model_registry.hpp"
 #include "net.hpp"
+#include "stats.hpp"
 #include "utils.hpp"
 
 class player {
  public:
-  player(){};
+  player(const std::string& name = "player") : stats(name){};
   virtual Board::Action generate(Board& b) { return 0; };
+  // forget the previous game; what is allocated stays for the next one
+  virtual void reset() {}
+  // counters of the most recent `generate` call
+  const SearchStats& last_stats() const { return stats; }
+  // if set, every `generate` appends its stats here as one JSON line
+  std::ostream* stats_log = nullptr;
+
+ protected:
+  SearchStats stats;
+  void report() {
+    stats.end();
+    if (stats_log) stats.write_json(*stats_log);
+  }
 };
 
 class random_player : public player {
  public:
-  random_player(){};
+  random_player() : player("random"){};
   virtual Board::Action generate(Board& b) { return b.shuffle_legal_move()[0]; }
 };
 
@@ -36,9 +52,12 @@ class mcts_player : public player {
   int sim_count = 0;
   int time_limit = 0;
   mcts_player(int sim_count = 500, int time_limit = 5)
-      : sim_count(sim_count), time_limit(time_limit){};
+      : player("mcts"), sim_count(sim_count), time_limit(time_limit){};
   virtual Board::Action generate(Board& b) {
-    return monte_carlo_tree_search(b, sim_count, time_limit);
+    stats.begin();
+    auto action = monte_carlo_tree_search(b, sim_count, time_limit, &stats);
+    report();
+    return action;
   }
 };
 
@@ -46,21 +65,80 @@ class nega_player : public player {
  public:
   int max_depth;
   bool heuristic;
-  NewNet<3, 8> net;
+  // Carry a `Net::Accumulator` down the search and update it per move instead
+  // of evaluating leaves from scratch. Off by default: for NewNet<3,8> a move
+  // touches ~6 of the 8 line features on every symmetry, so the scalar update
+  // is slower than the AVX2 full evaluation.
+  bool incremental = false;
+  using Net = NewNet<3, 8>;
+  // read-only and shared, by default the registry's copy of the model file;
+  // null if that couldn't be loaded, leaves are then worth 0
+  std::shared_ptr<const Net> net;
 
   // transposition table
   std::unordered_map<Board::Hash, Board::Reward> transposition_table;
-  nega_player(int max_depth = 3, bool heuristic = false)
-      : max_depth(max_depth), heuristic(heuristic), net("model/3_8_newNet.model"){};
-
-  Board::Reward evaluate(const Board& b) {
-    return net.evaluate(b);
+  // leaf evaluations, kept across moves and games; players sharing a net may
+  // share it
+  std::shared_ptr<EvalCache> eval_cache = std::make_shared<EvalCache>();
+  nega_player(int max_depth = 3, bool heuristic = false,
+              std::shared_ptr<const Net> net = nullptr)
+      : player("nega"),
+        max_depth(max_depth),
+        heuristic(heuristic),
+        net(net ? std::move(net)
+                : shared_model<Net>("model/3_8_newNet.model")){};
+
+  // keeps the current net if `load_path` can't be loaded
+  void load_model(const std::string& load_path) {
+    auto loaded = shared_model<Net>(load_path);
+    if (!loaded) return;
+    net = std::move(loaded);
+    if (eval_cache) eval_cache->clear();
   }
-  Board::Reward negamaxSearch(const Board& b, int depth, bool done,
+  // e.g. `quantize(Precision::Int8, buffer.states())` before a match; the
+  // player gets its own quantized copy of the net
+  void quantize(Precision p, std::span<const Board> calibration = {}) {
+    if (!net) return;
+    auto quantized = std::make_shared<Net>(*net);
+    quantized->quantize(p, calibration);
+    net = std::move(quantized);
+    if (eval_cache) eval_cache->clear();
+  }
+  // the table keeps its buckets; cached evaluations stay valid for the net
+  void reset() override { transposition_table.clear(); }
+  Board::Reward evaluate(const Board& b) { return evaluate(b, b.hash()); }
+  // `parent` is the accumulator before `action`, updated only on a miss
+  Board::Reward evaluate(const Board& b, Board::Hash hash,
+                         const Net::Accumulator* parent = nullptr,
+                         Board::Action action = -1) {
+    Board::Reward value;
+    STATS(stats.eval_probes++);
+    if (eval_cache && eval_cache->probe(hash, value)) {
+      STATS(stats.eval_hits++);
+      return value;
+    }
+    if (!net) {
+      value = 0;
+    } else if (incremental && parent) {
+      auto acc = *parent;
+      net->update(acc, b, action);
+      value = acc.value;
+    } else {
+      value = net->evaluate(b);
+    }
+    if (eval_cache) eval_cache->store(hash, value);
+    return value;
+  }
+  // `parent` is the evaluator state of the board before `action`
+  Board::Reward negamaxSearch(const Board& b, const Net::Accumulator& parent,
+                              Board::Action action, int depth, bool done,
                               Board::Reward alpha, Board::Reward beta) {
+    STATS(stats.nodes++);
     // Check if the state has already been evaluated
     Board::Hash hash = b.hash();
+    STATS(stats.tt_probes++);
     if (transposition_table.count(hash) > 0) {
+      STATS(stats.tt_hits++);
       return transposition_table[hash];
     }
 
@@ -69,21 +147,27 @@ class nega_player : public player {
       return 0;
     }
     if (depth == 0){
-      return evaluate(b);
+      return evaluate(b, hash, &parent, action);
     }
 
+    auto acc = parent;
+    if (incremental && net) net->update(acc, b, action);
     Board::Reward best_value = -std::numeric_limits<Board::Reward>::infinity();
+    int move_count = 0;
     // ... generate possible moves and evaluate them
     for (const Board::Action& action : b.shuffle_legal_move(heuristic)) {
       Board b_ = b;
       auto&& [r, done] = b_.apply(action);
-      Board::Reward eval =
-          r - negamaxSearch(b_, depth - 1, done, -beta, -alpha);
+      Board::Reward eval = r - negamaxSearch(b_, acc, action, depth - 1, done,
+                                             -beta, -alpha);
       best_value = std::max(best_value, eval);
       alpha = std::max(alpha, eval);
       if (beta <= alpha) {
+        STATS(stats.beta_cutoffs++);
+        STATS(stats.first_move_cutoffs += move_count == 0);
         break;  // Beta cutoff
       }
+      move_count++;
     }
     // Store the evaluated state in the transposition table
     transposition_table[hash] = best_value;
@@ -91,15 +175,18 @@ class nega_player : public player {
   };
 
   virtual Board::Action generate(Board& b) override {
+    stats.begin();
     transposition_table.clear();
     int best_action = -1;
+    const auto acc =
+        incremental && net ? net->accumulate(b) : Net::Accumulator{};
     Board::Reward best_value = -std::numeric_limits<Board::Reward>::infinity();
     for (auto& action : b.shuffle_legal_move()) {
       auto b_ = b;
       auto&& [reward, done] = b_.apply(action);
       Board::Reward value =
           reward -
-          negamaxSearch(b_, max_depth, done,
+          negamaxSearch(b_, acc, action, max_depth, done,
                         -std::numeric_limits<Board::Reward>::infinity(),
                         std::numeric_limits<Board::Reward>::infinity());
       if (value > best_value) {
@@ -107,6 +194,7 @@ class nega_player : public player {
         best_action = action;
       }
     }
+    report();
     return best_action;
   };
 };
@@ -115,14 +203,19 @@ class pvs_player : public nega_player {
  public:
   // transposition table
   pvs_player(int max_depth = 3, bool heuristic = false)
-      : nega_player(max_depth, heuristic){};
+      : nega_player(max_depth, heuristic) {
+    stats.player = "pvs";
+  };
 
   Board::Reward principalVariationSearch(const Board& b, int depth, bool done,
                                          Board::Reward alpha,
                                          Board::Reward beta) {
+    STATS(stats.nodes++);
     // Check if the state has already been evaluated
     Board::Hash hash = b.hash();
+    STATS(stats.tt_probes++);
     if (transposition_table.count(hash) > 0) {
+      STATS(stats.tt_hits++);
       return transposition_table[hash];
     }
 
@@ -133,6 +226,7 @@ class pvs_player : public nega_player {
 
     Board::Reward best_value = -std::numeric_limits<Board::Reward>::infinity();
     bool firstChild = true;
+    int move_count = 0;
 
     // Generate possible moves and evaluate them
     for (const Board::Action& action : b.shuffle_legal_move(heuristic)) {
@@ -155,8 +249,11 @@ class pvs_player : public nega_player {
       best_value = std::max(best_value, eval);
       alpha = std::max(alpha, eval);
       if (beta <= alpha) {
+        STATS(stats.beta_cutoffs++);
+        STATS(stats.first_move_cutoffs += move_count == 0);
         break;  // Beta cutoff
       }
+      move_count++;
     }
 
     // Store the evaluated state in the transposition table
@@ -165,6 +262,7 @@ class pvs_player : public nega_player {
   }
 
   virtual Board::Action generate(Board& b) override {
+    stats.begin();
     int best_action = -1;
     transposition_table.clear();
     Board::Reward best_value = -std::numeric_limits<Board::Reward>::infinity();
@@ -181,17 +279,20 @@ class pvs_player : public nega_player {
         best_action = action;
       }
     }
+    report();
     return best_action;
   };
 };
 
-class hybrid_player : player {
+class hybrid_player : public player {
  public:
-  hybrid_player(int time_limit = 57) : time_limit(time_limit){};
+  hybrid_player(int time_limit = 57)
+      : player("hybrid"), time_limit(time_limit){};
   int time_limit;
   bool mcts_done = false;
   bool negamax_done = false;
   std::unordered_map<Board::Hash, Board::Reward> transposition_table;
+  void reset() override { transposition_table.clear(); }
 
   Board::Action nega_generate(Board& b) {
     transposition_table.clear();
@@ -216,9 +317,12 @@ class hybrid_player : player {
   Board::Reward negamaxSearch(const Board& b, bool done, Board::Reward alpha,
                               Board::Reward beta) {
     if (mcts_done) return 0;
+    STATS(stats.nodes++);
     // Check if the state has already been evaluated
     Board::Hash hash = b.hash();
+    STATS(stats.tt_probes++);
     if (transposition_table.count(hash) > 0) {
+      STATS(stats.tt_hits++);
       return transposition_table[hash];
     }
 
@@ -228,6 +332,7 @@ class hybrid_player : player {
     }
 
     Board::Reward best_value = -std::numeric_limits<Board::Reward>::infinity();
+    int move_count = 0;
     // ... generate possible moves and evaluate them
     for (const Board::Action& action : b.shuffle_legal_move()) {
       Board b_ = b;
@@ -236,8 +341,11 @@ class hybrid_player : player {
       best_value = std::max(best_value, eval);
       alpha = std::max(alpha, eval);
       if (beta <= alpha) {
+        STATS(stats.beta_cutoffs++);
+        STATS(stats.first_move_cutoffs += move_count == 0);
         break;  // Beta cutoff
       }
+      move_count++;
     }
     // Store the evaluated state in the transposition table
     if (!mcts_done) transposition_table[hash] = best_value;
@@ -247,7 +355,7 @@ class hybrid_player : player {
   virtual Board::Action generate(Board& b) override {
     std::chrono::steady_clock::time_point start =
         std::chrono::steady_clock::now();
-    int sim_count = 0;
+    stats.begin();
     negamax_done = false;
     mcts_done = false;
 
@@ -261,17 +369,13 @@ class hybrid_player : player {
     std::thread mctsThread([&]() {
       Node* root = new Node(b);
       root->expand();
+      STATS(stats.tree_size += 1 + root->children.size());
 
       while (std::chrono::steady_clock::now() - start <
                  std::chrono::seconds(time_limit) &&
              !negamax_done) {
-        sim_count++;
-        Node* selected = root->select();
-        selected->expand();
-        Board::Reward score = selected->rollout();
-        selected->backpropagate(score);
+        mcts_iteration(root, stats);
       }
-      std::cout << "Simulations: " << sim_count << std::endl;
 
       Board::Reward best_reward =
           -std::numeric_limits<Board::Reward>::infinity();
@@ -290,6 +394,7 @@ class hybrid_player : player {
     if (negamaxThread.joinable()) negamaxThread.join();
     if (mctsThread.joinable()) mctsThread.join();
 
+    report();
     // Return the result from the finished thread
     return (negamax_done) ? negamax_result : mcts_result;
   };
@@ -0,0 +1,155 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "board.hpp"
+#include "replay_buffer.hpp"
+
+// The steps of a set of episodes with the states that are equal up to
+// symmetry merged, for nets that sum over all 8 symmetries (NewNet,
+// TupleNet); an MLP would only learn the canonical orientation.
+//
+// TD targets depend on the net, so instead of a fixed target each position
+// keeps the distinct moves seen out of it: `count` visits, of which the
+// transitions [first, first + size) account for all but the terminal ones.
+// Its mean TD target is then the count-weighted mean of `reward - V(next)`
+// over its transitions, 0 for the terminal visits, exactly the mean of the
+// targets `td_episode` would give its duplicates.
+struct Transition {
+  Board next;
+  Board::Reward reward;
+  uint32_t count;
+};
+struct Position {
+  Board board;
+  uint32_t count;
+  uint32_t first;
+  uint32_t size;
+};
+struct Aggregate {
+  std::vector<Position> positions;
+  std::vector<Transition> transitions;
+  size_t states = 0;
+
+  // the mean TD target of `p` under `net`
+  template <class Net>
+  Board::Reward target(const Net& net, const Position& p) const {
+    Board::Reward sum = 0;
+    for (uint32_t i = p.first; i < p.first + p.size; i++) {
+      const auto& [next, reward, count] = transitions[i];
+      sum += (reward - net.evaluate(next)) * count;
+    }
+    return sum / p.count;
+  }
+  void shuffle() {
+    thread_local std::mt19937 gen(std::random_device{}());
+    std::shuffle(positions.begin(), positions.end(), gen);
+  }
+};
+
+// Build the `Aggregate` of every state of `set`, the initial boards included,
+// keyed by canonical `Board::hash()`. The reduction is hash-partitioned: each
+// thread scatters the steps of its episodes into `partitions` buckets by
+// hash, then each partition is sorted and reduced by one thread without
+// touching the others. The result is in a fixed order whatever the thread
+// count.
+inline Aggregate aggregate(const EpisodeSet& set, int threads,
+                           int partitions = 256) {
+  // a visit of `key`, moving to `next` for `reward`, or terminal
+  struct Entry {
+    Board::Hash key;
+    Board::Hash next;
+    Board::Reward reward;
+    bool terminal;
+    auto tie() const { return std::tie(key, terminal, next, reward); }
+  };
+  auto partition = [&](Board::Hash key) {
+    return (key * 0x9e3779b97f4a7c15ull >> 32) % partitions;
+  };
+  auto run = [&](auto&& work) {
+    std::vector<std::thread> pool;
+    for (int tid = 1; tid < threads; tid++) pool.emplace_back(work, tid);
+    work(0);
+    for (auto& t : pool) t.join();
+  };
+
+  // buckets[tid * partitions + p]
+  std::vector<std::vector<Entry>> buckets(size_t(threads) * partitions);
+  run([&](int tid) {
+    auto* mine = &buckets[size_t(tid) * partitions];
+    for (size_t i = tid; i < set.size(); i += threads) {
+      const auto ep = set[i];
+      Board::Hash next = 0;
+      // state t - 1 moves to state t, the initial board standing in for -1
+      for (size_t t = ep.size() + 1; t-- > 0;) {
+        const Board::Hash key = (t ? ep.state(t - 1) : ep.init_state).hash();
+        const bool terminal = t == ep.size();
+        mine[partition(key)].push_back(
+            {key, next, terminal ? 0 : ep.reward(t), terminal});
+        next = key;
+      }
+    }
+  });
+
+  std::vector<Aggregate> reduced(partitions);
+  run([&](int tid) {
+    std::vector<Entry> entries;
+    for (int p = tid; p < partitions; p += threads) {
+      entries.clear();
+      for (int from = 0; from < threads; from++) {
+        auto& bucket = buckets[size_t(from) * partitions + p];
+        entries.insert(entries.end(), bucket.begin(), bucket.end());
+        std::vector<Entry>().swap(bucket);
+      }
+      std::sort(entries.begin(), entries.end(),
+                [](const Entry& a, const Entry& b) {
+                  return a.tie() < b.tie();
+                });
+      auto& out = reduced[p];
+      for (size_t j = 0; j < entries.size(); j++) {
+        const Entry& e = entries[j];
+        if (!j || e.key != entries[j - 1].key) {
+          out.positions.push_back(
+              {Board(e.key), 0, uint32_t(out.transitions.size()), 0});
+        }
+        Position& position = out.positions.back();
+        position.count++;
+        if (e.terminal) continue;
+        // terminal visits sort last, so a transition of this position
+        // precedes e whenever it has any
+        if (position.size && entries[j - 1].next == e.next &&
+            entries[j - 1].reward == e.reward) {
+          out.transitions.back().count++;
+        } else {
+          out.transitions.push_back({Board(e.next), e.reward, 1});
+          position.size++;
+        }
+      }
+      out.states = entries.size();
+    }
+  });
+
+  Aggregate result;
+  size_t positions = 0, transitions = 0;
+  for (const auto& r : reduced) {
+    positions += r.positions.size();
+    transitions += r.transitions.size();
+  }
+  result.positions.reserve(positions);
+  result.transitions.reserve(transitions);
+  for (const auto& r : reduced) {
+    const uint32_t offset = result.transitions.size();
+    for (auto position : r.positions) {
+      position.first += offset;
+      result.positions.push_back(position);
+    }
+    result.transitions.insert(result.transitions.end(), r.transitions.begin(),
+                              r.transitions.end());
+    result.states += r.states;
+  }
+  return result;
+}
@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "agent.hpp"
+#include "board.hpp"
+#include "episode.hpp"
+
+// Plays two player configurations against each other on `threads` threads
+// and reports the first one's Elo difference with a 95% confidence interval,
+// plus per-move wall-clock latency percentiles of both.
+//
+// Games come in pairs from the same random board, each side moving first
+// once, and the pair is the unit of the statistics: its mean score cancels
+// most of the luck of the starting board. With `sprt` the match stops as soon
+// as a sequential probability ratio test between elo0 (H0) and elo1 (H1)
+// accepts either, using the normal approximation of the log-likelihood ratio
+// over pair scores.
+//
+// players: random, mcts:SIMS, nega:DEPTH, pvs:DEPTH, hybrid:SECONDS
+// options: p1=, p2=, games=N (upper bound), threads=N, seed=S, b_max=, b_min=,
+// sprt, elo0=, elo1=, alpha=, beta=
+std::unique_ptr<player> make_player(const std::string& spec) {
+  const auto colon = spec.find(':');
+  const std::string name = spec.substr(0, colon);
+  const int arg =
+      colon == std::string::npos ? 0 : std::stoi(spec.substr(colon + 1));
+  if (name == "random") return std::make_unique<random_player>();
+  if (name == "mcts") return std::make_unique<mcts_player>(arg ? arg : 500);
+  if (name == "nega") return std::make_unique<nega_player>(arg ? arg : 3);
+  if (name == "pvs") return std::make_unique<pvs_player>(arg ? arg : 3);
+  if (name == "hybrid") return std::make_unique<hybrid_player>(arg ? arg : 57);
+  return nullptr;
+}
+
+// expected score of an Elo difference, and back
+double elo_score(double elo) { return 1 / (1 + std::pow(10, -elo / 400)); }
+double score_elo(double score) {
+  score = std::clamp(score, 1e-6, 1 - 1e-6);
+  return -400 * std::log10(1 / score - 1);
+}
+
+// p-th percentile of `v`, which gets sorted
+double percentile(std::vector<double>& v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, size_t(p * v.size()))];
+}
+
+int main(int argc, const char* argv[]) {
+  std::copy(argv, argv + argc,
+            std::ostream_iterator<const char*>(std::cout, " "));
+  std::cout << std::endl;
+  std::string specs[2] = {"nega:3", "mcts:500"};
+  size_t games = 1000;
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+  uint64_t seed = std::random_device{}();
+  int b_max = 99, b_min = 50;
+  bool sprt = false;
+  double elo0 = 0, elo1 = 10, alpha = 0.05, beta = 0.05;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto match_arg = [&](std::string flag) -> bool {
+      auto it = arg.find_first_not_of('-');
+      return arg.find(flag, it) == it;
+    };
+    auto next_opt = [&]() -> std::string {
+      auto it = arg.find('=') + 1;
+      return it ? arg.substr(it) : argv[++i];
+    };
+    if (match_arg("p1")) {
+      specs[0] = next_opt();
+    } else if (match_arg("p2")) {
+      specs[1] = next_opt();
+    } else if (match_arg("games")) {
+      games = std::stoull(next_opt());
+    } else if (match_arg("threads")) {
+      threads = std::max(1, std::stoi(next_opt()));
+    } else if (match_arg("seed")) {
+      seed = std::stoull(next_opt());
+    } else if (match_arg("b_max")) {
+      b_max = std::stoi(next_opt());
+    } else if (match_arg("b_min")) {
+      b_min = std::stoi(next_opt());
+    } else if (match_arg("sprt")) {
+      sprt = true;
+    } else if (match_arg("elo0")) {
+      elo0 = std::stod(next_opt());
+    } else if (match_arg("elo1")) {
+      elo1 = std::stod(next_opt());
+    } else if (match_arg("alpha")) {
+      alpha = std::stod(next_opt());
+    } else if (match_arg("beta")) {
+      beta = std::stod(next_opt());
+    }
+  }
+  for (const auto& spec : specs) {
+    if (!make_player(spec)) {
+      std::cout << "Unknown player " << spec << std::endl;
+      return 1;
+    }
+  }
+
+  const double lower = std::log(beta / (1 - alpha));
+  const double upper = std::log((1 - beta) / alpha);
+  const double s0 = elo_score(elo0), s1 = elo_score(elo1);
+
+  std::mutex mutex;
+  // guarded by `mutex`
+  size_t pairs = 0, wins = 0, draws = 0, losses = 0;
+  double sum = 0, sum_sq = 0, llr = 0;
+  std::vector<double> latency[2];
+  int verdict = 0;  // 1 H1 accepted, -1 H0 accepted
+
+  std::atomic<size_t> next = 0;
+  std::atomic<bool> stop = false;
+  auto worker = [&](int tid) {
+    Board::seed_rng(seed + tid);
+    auto a = make_player(specs[0]);
+    auto b = make_player(specs[1]);
+    std::vector<double> times[2];
+    auto on_move = [&](int pid, double seconds) {
+      times[pid].push_back(seconds);
+    };
+    while (!stop.load(std::memory_order_relaxed) &&
+           next.fetch_add(1) < games / 2) {
+      const Board start = RandomBoard(b_max, b_min);
+      double score = 0;
+      int outcome[3] = {};  // win, draw, loss
+      for (int first = 0; first < 2; first++) {
+        auto ep = PlayFrom(*a, *b, start, first, false, on_move);
+        const int w = ep.win();
+        const double s = w == 0 ? 1 : w == 1 ? 0 : 0.5;
+        score += s / 2;
+        outcome[w == 0 ? 0 : w == 1 ? 2 : 1]++;
+      }
+
+      std::lock_guard lock(mutex);
+      for (int pid = 0; pid < 2; pid++) {
+        latency[pid].insert(latency[pid].end(), times[pid].begin(),
+                            times[pid].end());
+        times[pid].clear();
+      }
+      pairs++;
+      wins += outcome[0];
+      draws += outcome[1];
+      losses += outcome[2];
+      sum += score;
+      sum_sq += score * score;
+      // the LLR counts one extra lost and one extra won pair, so its variance
+      // isn't 0 while one side wins everything
+      const double n = pairs + 2;
+      const double mean = (sum + 1) / n;
+      const double var = (sum_sq + 1) / n - mean * mean;
+      if (!verdict) llr = n * (s1 - s0) * (2 * mean - s0 - s1) / (2 * var);
+      if (pairs % 10 == 0) {
+        std::cout << "games " << 2 * pairs << " | +" << wins << " =" << draws
+                  << " -" << losses << " | elo " << score_elo(sum / pairs);
+        if (sprt) std::cout << " | llr " << llr;
+        std::cout << std::endl;
+      }
+      if (sprt && !verdict && (llr <= lower || llr >= upper)) {
+        verdict = llr >= upper ? 1 : -1;
+        stop = true;
+      }
+    }
+  };
+  const auto begin = std::chrono::steady_clock::now();
+  std::vector<std::thread> pool;
+  for (int tid = 1; tid < threads; tid++) pool.emplace_back(worker, tid);
+  worker(0);
+  for (auto& t : pool) t.join();
+  const double wall =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - begin)
+          .count();
+
+  const double mean = pairs ? sum / pairs : 0.5;
+  const double var = pairs ? sum_sq / pairs - mean * mean : 0;
+  const double margin = pairs > 1 ? 1.96 * std::sqrt(var / (pairs - 1)) : 0;
+  std::cout.precision(4);
+  std::cout << specs[0] << " vs " << specs[1] << ": " << 2 * pairs
+            << " games in " << wall << " sec on " << threads << " threads"
+            << std::endl;
+  std::cout << "+" << wins << " =" << draws << " -" << losses
+            << " | score " << mean << " | elo " << score_elo(mean) << " ["
+            << score_elo(mean - margin) << ", " << score_elo(mean + margin)
+            << "]" << std::endl;
+  if (sprt) {
+    std::cout << "SPRT elo0=" << elo0 << " elo1=" << elo1 << " llr " << llr
+              << " [" << lower << ", " << upper << "]: "
+              << (verdict > 0   ? "H1 accepted"
+                  : verdict < 0 ? "H0 accepted"
+                                : "inconclusive")
+              << std::endl;
+  }
+  for (int pid = 0; pid < 2; pid++) {
+    auto& v = latency[pid];
+    const double max = v.empty() ? 0 : *std::max_element(v.begin(), v.end());
+    const double p50 = percentile(v, 0.5), p99 = percentile(v, 0.99);
+    std::cout << specs[pid] << " move latency (ms): p50 " << p50 * 1e3
+              << " | p99 " << p99 * 1e3 << " | max " << max * 1e3 << " ("
+              << v.size() << " moves)" << std::endl;
+  }
+}
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "agent.hpp"
+#include "board.hpp"
+#include "episode.hpp"
+#include "fixed_net.hpp"
+#include "mcts.hpp"
+#include "net.hpp"
+
+// Microbenchmarks for the hot paths, over a fixed set of positions taken
+// from random games with a fixed seed. Every benchmark is sized to run at
+// least `min_time` seconds per repetition, runs `warmup` unrecorded
+// repetitions and then `reps` timed ones; the median rate is the result.
+//
+// options: reps=N, warmup=N, min_time=SECONDS, filter=SUBSTRING (run only
+// matching benchmarks), json=PATH (also write the results as JSON)
+//
+// Search rates count what the search reports in its `SearchStats`, so they
+// read 0 in a -DNO_SEARCH_STATS build.
+using Clock = std::chrono::steady_clock;
+
+// keep `v` alive without the compiler seeing through it
+template <class T>
+inline void keep(const T& v) {
+  asm volatile("" : : "r,m"(v) : "memory");
+}
+
+struct Result {
+  std::string name;
+  std::string unit;
+  uint64_t ops_per_rep;
+  // memory of the tables behind the benchmark, 0 if not applicable
+  size_t table_bytes;
+  // per repetition, in `unit` per second
+  std::vector<double> rates;
+  double median() const {
+    auto v = rates;
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+  }
+};
+
+int main(int argc, const char* argv[]) {
+  int reps = 5, warmup = 1;
+  double min_time = 0.2;
+  std::string filter = "", json_path = "";
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto match_arg = [&](std::string flag) -> bool {
+      auto it = arg.find_first_not_of('-');
+      return arg.find(flag, it) == it;
+    };
+    auto next_opt = [&]() -> std::string {
+      auto it = arg.find('=') + 1;
+      return it ? arg.substr(it) : argv[++i];
+    };
+    if (match_arg("reps")) {
+      reps = std::max(1, std::stoi(next_opt()));
+    } else if (match_arg("warmup")) {
+      warmup = std::stoi(next_opt());
+    } else if (match_arg("min_time")) {
+      min_time = std::stod(next_opt());
+    } else if (match_arg("filter")) {
+      filter = next_opt();
+    } else if (match_arg("json")) {
+      json_path = next_opt();
+    }
+  }
+
+  // positions from random games, and one legal move out of each
+  Board::seed_rng(2048);
+  std::vector<Board> boards;
+  std::vector<Board::Action> moves;
+  while (boards.size() < 4096) {
+    Board b = RandomBoard();
+    for (bool done = false; !done;) {
+      const auto legal = b.shuffle_legal_move();
+      boards.push_back(b);
+      moves.push_back(legal[0]);
+      done = std::get<1>(b.apply(legal[0]));
+    }
+  }
+  boards.resize(4096);
+  moves.resize(4096);
+  const size_t mask = boards.size() - 1;
+  // every 64th position for the searches, which are far slower
+  std::vector<Board> roots;
+  for (size_t i = 0; i < boards.size(); i += 64) roots.push_back(boards[i]);
+
+  std::vector<Result> results;
+  // `f(n)` does n operations and returns how many `unit`s that was
+  auto run = [&](const std::string& name, const std::string& unit, auto&& f,
+                 size_t table_bytes = 0) {
+    if (name.find(filter) == std::string::npos) return;
+    Result r{name, unit, 1, table_bytes, {}};
+    for (;;) {
+      const auto start = Clock::now();
+      f(r.ops_per_rep);
+      if (std::chrono::duration<double>(Clock::now() - start).count() >=
+          min_time) {
+        break;
+      }
+      r.ops_per_rep *= 2;
+    }
+    for (int rep = -warmup; rep < reps; rep++) {
+      const auto start = Clock::now();
+      const uint64_t units = f(r.ops_per_rep);
+      const double seconds =
+          std::chrono::duration<double>(Clock::now() - start).count();
+      if (rep >= 0) r.rates.push_back(units / seconds);
+    }
+    std::cout.precision(4);
+    std::cout << name << ": " << r.median() << " " << unit << "/sec ("
+              << 1e9 / r.median() << " ns each, median of " << reps << ")";
+    if (table_bytes) std::cout << " | tables " << table_bytes / 1e6 << " MB";
+    std::cout << std::endl;
+    results.push_back(std::move(r));
+  };
+  auto over_boards = [&](auto&& op) {
+    return [&, op](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) op(i & mask, i);
+      return n;
+    };
+  };
+
+  run("board.legal", "calls", over_boards([&](size_t j, uint64_t i) {
+        keep(boards[j].legal(i % 18));
+      }));
+  run("board.apply", "calls", over_boards([&](size_t j, uint64_t) {
+        Board b = boards[j];
+        keep(b.apply(moves[j]));
+      }));
+  run("board.terminated", "calls", over_boards([&](size_t j, uint64_t) {
+        Board b = boards[j];
+        keep(b.terminated());
+      }));
+  run("board.hash", "calls", over_boards([&](size_t j, uint64_t) {
+        keep(boards[j].hash());
+      }));
+  run("board.shuffle_legal_move", "calls",
+      over_boards([&](size_t j, uint64_t) {
+        keep(boards[j].shuffle_legal_move().size());
+      }));
+
+  static constexpr Layout<3, 8> lines = {{{0, 1, 2},
+                                          {3, 4, 5},
+                                          {6, 7, 8},
+                                          {0, 3, 6},
+                                          {1, 4, 7},
+                                          {2, 5, 8},
+                                          {0, 4, 8},
+                                          {2, 4, 6}}};
+  NewNet<3, 8> new_net(lines);
+  new_net.load("model/3_8_newNet.model");
+  auto tuple_net = std::make_unique<TupleNet<3, 8>>(lines);
+  run("newnet.evaluate", "calls", over_boards([&](size_t j, uint64_t) {
+        keep(new_net.evaluate(boards[j]));
+      }));
+  run("newnet.update_net", "calls", over_boards([&](size_t j, uint64_t) {
+        new_net.update_net(boards[j], 1e-3f, 1e-6f);
+      }));
+  run(
+      "tuplenet.evaluate", "calls",
+      over_boards([&](size_t j, uint64_t) {
+        keep(tuple_net->evaluate(boards[j]));
+      }),
+      tuple_net->table_bytes());
+  run("tuplenet.update_net", "calls", over_boards([&](size_t j, uint64_t) {
+        tuple_net->update_net(boards[j], 1e-3f, 1e-6f);
+      }));
+  auto bucket_net = std::make_unique<TupleNet<3, 8, BucketIndex>>(lines);
+  run(
+      "tuplenet_bucket.evaluate", "calls",
+      over_boards([&](size_t j, uint64_t) {
+        keep(bucket_net->evaluate(boards[j]));
+      }),
+      bucket_net->table_bytes());
+  run("tuplenet_bucket.update_net", "calls",
+      over_boards([&](size_t j, uint64_t) {
+        bucket_net->update_net(boards[j], 1e-3f, 1e-6f);
+      }));
+  // the same layouts fixed at compile time
+  FixedNewNet<lines> fixed_new_net("model/3_8_newNet.model");
+  run("fixednewnet.evaluate", "calls", over_boards([&](size_t j, uint64_t) {
+        keep(fixed_new_net.evaluate(boards[j]));
+      }));
+  auto fixed_tuple_net = std::make_unique<FixedTupleNet<lines>>();
+  run("fixedtuplenet.evaluate", "calls", over_boards([&](size_t j, uint64_t) {
+        keep(fixed_tuple_net->evaluate(boards[j]));
+      }));
+
+  run("mcts.iterations", "iterations", [&](uint64_t n) {
+    SearchStats stats;
+    for (uint64_t i = 0; i < n; i++) {
+      mcts_estimate(roots[i % roots.size()], 100, &stats);
+    }
+    return stats.simulations;
+  });
+  nega_player nega(3);
+  run("negamax.nodes", "nodes", [&](uint64_t n) {
+    uint64_t nodes = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      // a cold evaluation cache each time, so every search does the same work
+      nega.eval_cache->clear();
+      Board b = roots[i % roots.size()];
+      nega.generate(b);
+      nodes += nega.last_stats().nodes;
+    }
+    return nodes;
+  });
+
+  if (json_path.empty()) return 0;
+  std::ofstream out(json_path);
+  if (!out.is_open()) {
+    std::cout << "Cannot open file " << json_path << std::endl;
+    return 1;
+  }
+  out.precision(6);
+  out << "{\"reps\":" << reps << ",\"warmup\":" << warmup
+      << ",\"min_time\":" << min_time << ",\"avx2\":"
+#ifdef NET_X86
+      << (cpu_has_avx2 ? "true" : "false")
+#else
+      << "false"
+#endif
+      << ",\"benchmarks\":[";
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& r = results[i];
+    const auto [min, max] = std::minmax_element(r.rates.begin(), r.rates.end());
+    out << (i ? "," : "") << "\n{\"name\":\"" << r.name << "\",\"unit\":\""
+        << r.unit << "\",\"ops_per_rep\":" << r.ops_per_rep
+        << ",\"table_bytes\":" << r.table_bytes
+        << ",\"median_per_sec\":" << r.median() << ",\"min_per_sec\":" << *min
+        << ",\"max_per_sec\":" << *max
+        << ",\"ns_each\":" << 1e9 / r.median() << ",\"rates\":[";
+    for (size_t j = 0; j < r.rates.size(); j++) {
+      out << (j ? "," : "") << r.rates[j];
+    }
+    out << "]}";
+  }
+  out << "\n]}\n";
+}
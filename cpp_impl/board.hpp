@@ -1,5 +1,6 @@
 #pragma once
 #include <algorithm>
+#include <array>
 #include <iostream>
 #include <ranges>
 #include <vector>
@@ -23,12 +24,14 @@ class Board {
   using Action = int;
   using Hash = uint64_t;
 
+  // cell `index` of the `isomorphic`-th symmetric board is cell
+  // `isom_table[isomorphic][index]` of this one
+  static constexpr int isom_table[8][9] = {
+      {0, 1, 2, 3, 4, 5, 6, 7, 8}, {2, 5, 8, 1, 4, 7, 0, 3, 6},
+      {8, 7, 6, 5, 4, 3, 2, 1, 0}, {6, 3, 0, 7, 4, 1, 8, 5, 2},
+      {2, 1, 0, 5, 4, 3, 8, 7, 6}, {0, 3, 6, 1, 4, 7, 2, 5, 8},
+      {6, 7, 8, 3, 4, 5, 0, 1, 2}, {8, 5, 2, 7, 4, 1, 6, 3, 0}};
   inline int get(const int index, const int isomorphic = 0) const noexcept {
-    static constexpr int isom_table[8][9] = {
-        {0, 1, 2, 3, 4, 5, 6, 7, 8}, {2, 5, 8, 1, 4, 7, 0, 3, 6},
-        {8, 7, 6, 5, 4, 3, 2, 1, 0}, {6, 3, 0, 7, 4, 1, 8, 5, 2},
-        {2, 1, 0, 5, 4, 3, 8, 7, 6}, {0, 3, 6, 1, 4, 7, 2, 5, 8},
-        {6, 7, 8, 3, 4, 5, 0, 1, 2}, {8, 5, 2, 7, 4, 1, 6, 3, 0}};
     return int((raw >> (isom_table[isomorphic][index] * 7)) & 0b1111111ull);
   }
   inline void set(const uint8_t index, uint64_t value) {
@@ -95,6 +98,22 @@ class Board {
     flip();
   }
 
+  // the 8 symmetric boards, built with the bit-twiddling transforms
+  inline std::array<Board, 8> isomorphisms() const {
+    std::array<Board, 8> result;
+    Board b(raw);
+    for (int i = 0; i < 4; i++) {
+      result[i] = b;
+      b.rotate_right();
+    }
+    b.mirror();
+    for (int i = 4; i < 8; i++) {
+      result[i] = b;
+      b.rotate_right();
+    }
+    return result;
+  }
+
   inline uint64_t hash() const {
     auto b = Board(raw);
     uint64_t h = 0xffffffffffffffffull;
@@ -181,10 +200,20 @@ class Board {
     return min;
   };
 
+  // the calling thread's generator for move shuffling and random boards,
+  // seeded from std::random_device unless `seed_rng` is called first
+  static std::mt19937& rng() {
+    thread_local std::mt19937 gen(std::random_device{}());
+    return gen;
+  }
+  static void seed_rng(uint64_t seed) {
+    std::seed_seq seq{uint32_t(seed), uint32_t(seed >> 32)};
+    rng().seed(seq);
+  }
+
   std::vector<Action> shuffle_legal_move(bool heuristic = false, int low = 0,
                                          int N = 18) const {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
+    auto& gen = rng();
     std::vector<int> numbers(N - low, 0);
     std::iota(numbers.begin(), numbers.end(), low);
     if (heuristic) {
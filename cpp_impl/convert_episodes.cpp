@@ -0,0 +1,75 @@
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+#include "episode.hpp"
+#include "episode_file.hpp"
+#include "replay_buffer.hpp"
+
+// Converts legacy text trajectories to the binary episode format, then reads
+// the result back and checks every replayed reward and state against the
+// text file.
+// usage: convert_episodes <in.episode> <out.episode>
+int main(int argc, const char* argv[]) {
+  if (argc != 3) {
+    std::cout << "usage: " << argv[0] << " <text episodes> <binary episodes>"
+              << std::endl;
+    return 1;
+  }
+  const std::string in_path = argv[1], out_path = argv[2];
+  if (is_episode_file(in_path)) {
+    std::cout << in_path << " is already binary" << std::endl;
+    return 1;
+  }
+  std::filesystem::remove(out_path);
+  auto begin = std::chrono::steady_clock::now();
+  std::vector<Episode> episodes;
+  std::vector<int> ids;
+  ReplayBuffer::read_text(in_path, [&](const Episode& ep, int id) {
+    episodes.push_back(ep);
+    ids.push_back(id);
+  });
+  std::chrono::duration<double> read = std::chrono::steady_clock::now() - begin;
+  begin = std::chrono::steady_clock::now();
+  {
+    EpisodeWriter writer(out_path);
+    if (!writer.is_open()) return 1;
+    for (size_t i = 0; i < episodes.size(); i++) {
+      writer.write(episodes[i], ids[i]);
+    }
+  }
+  std::chrono::duration<double> write =
+      std::chrono::steady_clock::now() - begin;
+
+  begin = std::chrono::steady_clock::now();
+  EpisodeReader reader(out_path);
+  size_t i = 0, mismatches = 0;
+  reader.for_each([&](const Episode& ep, uint64_t id) {
+    const Episode& ref = episodes[i++];
+    bool same = id == uint64_t(ids[i - 1]) &&
+                ep.history.size() == ref.history.size() &&
+                ep.scores[0] == ref.scores[0] && ep.scores[1] == ref.scores[1];
+    for (size_t t = 0; same && t < ep.history.size(); t++) {
+      same = ep.history[t].action == ref.history[t].action &&
+             ep.history[t].reward == ref.history[t].reward &&
+             ep.history[t].state.hash() == ref.history[t].state.hash();
+    }
+    mismatches += !same;
+  });
+  std::chrono::duration<double> check =
+      std::chrono::steady_clock::now() - begin;
+
+  const auto in_bytes = std::filesystem::file_size(in_path);
+  const auto out_bytes = std::filesystem::file_size(out_path);
+  std::cout.precision(3);
+  std::cout << episodes.size() << " episodes, " << in_bytes << " -> "
+            << out_bytes << " bytes (" << double(in_bytes) / out_bytes
+            << "x) || text read " << read.count() << " sec, binary write "
+            << write.count() << " sec, binary read " << check.count()
+            << " sec" << std::endl;
+  if (i != episodes.size() || mismatches) {
+    std::cout << "Mismatch: " << i << " episodes read back, " << mismatches
+              << " differ" << std::endl;
+    return 1;
+  }
+}
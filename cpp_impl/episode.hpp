@@ -1,14 +1,40 @@
 #pragma once
 #include <time.h>
 
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <numeric>
+#include <random>
 #include <sstream>
+#include <string>
 #include <vector>
 
 #include "agent.hpp"
 #include "board.hpp"
 class ReplayBuffer;
+
+// LEB128 varints for the binary episode format
+inline void put_varint(std::string& out, uint64_t v) {
+  for (; v >= 0x80; v >>= 7) out.push_back(char(v | 0x80));
+  out.push_back(char(v));
+}
+inline bool get_varint(const char*& p, const char* end, uint64_t& v) {
+  v = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    const uint8_t byte = *p++;
+    v |= uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+inline uint64_t zigzag(int64_t v) { return (uint64_t(v) << 1) ^ (v >> 63); }
+inline int64_t unzigzag(uint64_t v) {
+  return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
 class Episode {
   friend class ReplayBuffer;
 
@@ -28,7 +54,11 @@ class Episode {
   clock_t max_time[2] = {-std::numeric_limits<clock_t>::infinity(),
                          -std::numeric_limits<clock_t>::infinity()};
   clock_t time = 0;
-  size_t size() { return history.size(); };
+  size_t size() const { return history.size(); };
+  // the same accessors as `EpisodeView`, so either can be trained on
+  Board::Action action(size_t t) const { return history[t].action; }
+  Board::Reward reward(size_t t) const { return history[t].reward; }
+  const Board& state(size_t t) const { return history[t].state; }
   void add(const Step& s) { history.push_back(s); }
   int win() {
     if (scores[0] > scores[1]) return 0;
@@ -45,25 +75,88 @@ class Episode {
     out << "\n";
     out.close();
   }
+  // Binary record: id, scores and time as varints, the raw initial board,
+  // then the step count and the actions packed 5 bits each. Rewards and
+  // states are replayed with `Board::apply` on decode.
+  void encode(std::string& out, uint64_t id) const {
+    put_varint(out, id);
+    put_varint(out, zigzag(std::lround(scores[0])));
+    put_varint(out, zigzag(std::lround(scores[1])));
+    put_varint(out, time);
+    char raw[8];
+    std::memcpy(raw, &init_state.raw, 8);
+    out.append(raw, 8);
+    put_varint(out, history.size());
+    uint32_t bits = 0;
+    int n = 0;
+    for (const auto& step : history) {
+      bits |= uint32_t(step.action) << n;
+      if ((n += 5) >= 8) {
+        out.push_back(char(bits));
+        bits >>= 8;
+        n -= 8;
+      }
+    }
+    if (n) out.push_back(char(bits));
+  }
+  // false if the record is truncated or holds an illegal move
+  bool decode(const char* p, const char* end, uint64_t& id) {
+    uint64_t s0, s1, t, steps;
+    if (!get_varint(p, end, id) || !get_varint(p, end, s0) ||
+        !get_varint(p, end, s1) || !get_varint(p, end, t) || end - p < 8) {
+      return false;
+    }
+    scores[0] = unzigzag(s0);
+    scores[1] = unzigzag(s1);
+    time = t;
+    std::memcpy(&init_state.raw, p, 8);
+    p += 8;
+    if (!get_varint(p, end, steps) ||
+        uint64_t(end - p) < (steps * 5 + 7) / 8) {
+      return false;
+    }
+    history.clear();
+    history.reserve(steps);
+    Board b = init_state;
+    uint32_t bits = 0;
+    int n = 0;
+    for (uint64_t i = 0; i < steps; i++) {
+      if (n < 5) {
+        bits |= uint32_t(uint8_t(*p++)) << n;
+        n += 8;
+      }
+      const Board::Action action = bits & 0x1f;
+      bits >>= 5;
+      n -= 5;
+      if (action >= 18 || !b.legal(action)) return false;
+      auto&& [reward, done] = b.apply(action);
+      history.push_back({action, reward, b});
+    }
+    return true;
+  }
 };
 
-Episode PlayAnEpisode(player& p1, player& p2, const int play_first = 0,
-                      int Board_max = 99, int Board_min = 50,
-                      const bool verbose = false) {
-  Board b;
-  for (int i = 0; i < 9; i++) {
-    b.set(i, std::rand() % (Board_max - Board_min + 1) + Board_min);
-  };
-
+// Play one game from `b`. Move times are wall-clock, kept in `clock()`
+// ticks for `Episode::max_time`; `on_move(pid, seconds)`, if set, also gets
+// each one.
+Episode PlayFrom(player& p1, player& p2, Board b, const int play_first = 0,
+                 const bool verbose = false,
+                 const std::function<void(int, double)>& on_move = {}) {
+  using Clock = std::chrono::steady_clock;
+  using Ticks = std::chrono::duration<clock_t, std::ratio<1, CLOCKS_PER_SEC>>;
   Episode ep(b);
+  p1.reset();
+  p2.reset();
   int pid = play_first;
-  auto ep_start = clock();
+  auto ep_start = Clock::now();
 
   while (true) {
     auto& who = (pid % 2 == 0) ? p1 : p2;
-    auto start = clock();
+    auto start = Clock::now();
     int action = who.generate(b);
-    auto elapse = clock() - start;
+    auto wall = Clock::now() - start;
+    auto elapse = std::chrono::duration_cast<Ticks>(wall).count();
+    if (on_move) on_move(pid, std::chrono::duration<double>(wall).count());
     ep.max_time[pid] = (elapse > ep.max_time[pid]) ? elapse : ep.max_time[pid];
     auto&& [reward, done] = b.apply(action);
     if (verbose) {
@@ -77,14 +170,50 @@ Episode PlayAnEpisode(player& p1, player& p2, const int play_first = 0,
     if (done) break;
     pid = (pid + 1) % 2;
   }
-  auto ep_elapse = clock() - ep_start;
-  ep.time = ep_elapse / CLOCKS_PER_SEC;
+  ep.time = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() -
+                                                             ep_start)
+                .count();
   if (verbose) {
     std::cout << "Player " << ep.win() << " win!\n";
   }
   return ep;
 }
 
+// a random board with every cell in [Board_min, Board_max]
+Board RandomBoard(int Board_max = 99, int Board_min = 50) {
+  Board b;
+  std::uniform_int_distribution<int> cell(Board_min, Board_max);
+  for (int i = 0; i < 9; i++) {
+    b.set(i, cell(Board::rng()));
+  };
+  return b;
+}
+
+Episode PlayAnEpisode(player& p1, player& p2, const int play_first = 0,
+                      int Board_max = 99, int Board_min = 50,
+                      const bool verbose = false) {
+  return PlayFrom(p1, p2, RandomBoard(Board_max, Board_min), play_first,
+                  verbose);
+}
+
+// TD(0) over one episode (an `Episode` or an `EpisodeView`), walking it
+// backwards. `update(board, error)` applies or records the update; returns
+// the mean |error|.
+template <class Net, class Ep, class Update>
+Board::Reward td_episode(Net& net, const Ep& ep, Update&& update) {
+  Board::Reward target = 0;
+  Board::Reward loss = 0;
+  for (size_t t = ep.size(); t-- > 0;) {
+    const Board& b_next = ep.state(t);
+    Board::Reward error = target - net.evaluate(b_next);
+    loss += std::abs(error);
+    update(b_next, error);
+    target = ep.reward(t) - net.evaluate(b_next);
+  }
+  update(ep.init_state, target - net.evaluate(ep.init_state));
+  return loss / ep.size();
+}
+
 std::tuple<float, float> test_player0(player& p1, player& p2,
                                       int num_to_play = 100, size_t b_max = 99,
                                       size_t b_min = 50, bool verbose = false) {
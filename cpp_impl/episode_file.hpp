@@ -0,0 +1,209 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "episode.hpp"
+#include "mapped_file.hpp"
+
+// Binary episode files:
+//
+//   magic, version                      8 + 4 bytes
+//   block*                              appended as they fill up
+//
+// A block is a fixed header (episode count, payload bytes, both uint32) and
+// then one varint length-prefixed `Episode::encode` record per episode. The
+// reader builds its block index by hopping from header to header, so there
+// is no trailer to rewrite and a file can be appended to by later runs.
+inline constexpr char episode_magic[8] = {'2', '0', '4', '8', 'E', 'P', 'S', 0};
+inline constexpr uint32_t episode_version = 1;
+
+inline bool is_episode_file(const std::string& path) {
+  char magic[sizeof(episode_magic)] = {};
+  std::ifstream(path, std::ios::binary).read(magic, sizeof(magic));
+  return std::memcmp(magic, episode_magic, sizeof(magic)) == 0;
+}
+
+// Buffers encoded episodes and writes them a block at a time, on `flush`
+// and on destruction. An existing file is appended to, after cutting off a
+// block a crash left incomplete; readers would otherwise take the new blocks
+// for the rest of it.
+class EpisodeWriter {
+ public:
+  EpisodeWriter(const std::string& path, size_t block_episodes = 256)
+      : block_episodes(block_episodes) {
+    std::ifstream probe(path, std::ios::binary | std::ios::ate);
+    bool empty = !probe.is_open() || probe.tellg() == 0;
+    probe.close();
+    if (!empty && !is_episode_file(path)) {
+      std::cout << path << " is not a binary episode file" << std::endl;
+      return;
+    }
+    if (!empty) {
+      const uint64_t size = std::filesystem::file_size(path);
+      const uint64_t complete = complete_bytes(path, size);
+      if (complete < size) {
+        std::cout << "Dropping " << size - complete
+                  << " bytes of an incomplete block from " << path
+                  << std::endl;
+        std::filesystem::resize_file(path, complete);
+        empty = complete == 0;
+      }
+    }
+    out.open(path, std::ios::binary | std::ios::app);
+    if (!out.is_open()) {
+      std::cout << "Cannot open file " << path << std::endl;
+      return;
+    }
+    if (empty) {
+      out.write(episode_magic, sizeof(episode_magic));
+      out.write(reinterpret_cast<const char*>(&episode_version),
+                sizeof(episode_version));
+    }
+  }
+  ~EpisodeWriter() { flush(); }
+  EpisodeWriter(const EpisodeWriter&) = delete;
+  EpisodeWriter& operator=(const EpisodeWriter&) = delete;
+
+  bool is_open() const { return out.is_open(); }
+  void write(const Episode& ep, uint64_t id) {
+    record.clear();
+    ep.encode(record, id);
+    put_varint(block, record.size());
+    block += record;
+    if (++count == block_episodes) flush();
+  }
+  void flush() {
+    if (!count || !out.is_open()) return;
+    const uint32_t header[2] = {uint32_t(count), uint32_t(block.size())};
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(block.data(), block.size());
+    out.flush();
+    block.clear();
+    count = 0;
+  }
+
+ private:
+  // length of the file up to the end of its last complete block
+  static uint64_t complete_bytes(const std::string& path, uint64_t size) {
+    std::ifstream in(path, std::ios::binary);
+    uint64_t pos = sizeof(episode_magic) + sizeof(episode_version);
+    // not even the file header made it, start over
+    if (size < pos) return 0;
+    uint32_t header[2];
+    while (size - pos >= sizeof(header) && in.seekg(pos) &&
+           in.read(reinterpret_cast<char*>(header), sizeof(header)) &&
+           size - pos - sizeof(header) >= header[1]) {
+      pos += sizeof(header) + header[1];
+    }
+    return pos;
+  }
+
+  std::ofstream out;
+  size_t block_episodes;
+  size_t count = 0;
+  std::string block;
+  std::string record;
+};
+
+// Read-only view of a binary episode file. Episodes are decoded on demand:
+// `get(i)` decodes only the record it needs, skipping earlier records of the
+// same block by their length prefix.
+class EpisodeReader {
+ public:
+  EpisodeReader(const std::string& path) : file(path) {
+    if (!file.is_open()) {
+      std::cout << "Cannot open file " << path << std::endl;
+      return;
+    }
+    const char* p = file.data();
+    const char* end = p + file.size();
+    uint32_t version = 0;
+    if (file.size() < header_bytes ||
+        std::memcmp(p, episode_magic, sizeof(episode_magic)) != 0) {
+      std::cout << path << " is not a binary episode file" << std::endl;
+      return;
+    }
+    std::memcpy(&version, p + sizeof(episode_magic), sizeof(version));
+    if (version != episode_version) {
+      std::cout << "Unsupported episode version " << version << " in " << path
+                << std::endl;
+      return;
+    }
+    size_t first = 0;
+    for (p += header_bytes; end - p >= 8;) {
+      uint32_t header[2];
+      std::memcpy(header, p, sizeof(header));
+      p += sizeof(header);
+      // a block cut short by a crash ends the file
+      if (uint64_t(end - p) < header[1]) break;
+      blocks.push_back({p, p + header[1], first});
+      first += header[0];
+      p += header[1];
+    }
+    episodes = first;
+    valid = true;
+  }
+
+  bool is_valid() const { return valid; }
+  size_t size() const { return episodes; }
+  bool get(size_t i, Episode& ep, uint64_t* id = nullptr) const {
+    auto it = std::upper_bound(
+        blocks.begin(), blocks.end(), i,
+        [](size_t i, const Block& b) { return i < b.first; });
+    if (i >= episodes || it == blocks.begin()) return false;
+    --it;
+    const char* p = it->begin;
+    for (size_t j = it->first;; j++) {
+      uint64_t length;
+      if (!get_varint(p, it->end, length) || uint64_t(it->end - p) < length) {
+        return false;
+      }
+      if (j == i) {
+        uint64_t record_id;
+        if (!ep.decode(p, p + length, record_id)) return false;
+        if (id) *id = record_id;
+        return true;
+      }
+      p += length;
+    }
+  }
+  // decode every episode in order, `f(ep, id)`; stops at a corrupt record
+  template <class F>
+  size_t for_each(F&& f) const {
+    size_t n = 0;
+    Episode ep;
+    for (const auto& block : blocks) {
+      for (const char* p = block.begin; p < block.end;) {
+        uint64_t length, id;
+        if (!get_varint(p, block.end, length) ||
+            uint64_t(block.end - p) < length || !ep.decode(p, p + length, id)) {
+          return n;
+        }
+        f(ep, id);
+        n++;
+        p += length;
+      }
+    }
+    return n;
+  }
+
+ private:
+  static constexpr size_t header_bytes =
+      sizeof(episode_magic) + sizeof(episode_version);
+  struct Block {
+    const char* begin;
+    const char* end;
+    size_t first;
+  };
+  MappedFile file;
+  std::vector<Block> blocks;
+  size_t episodes = 0;
+  bool valid = false;
+};
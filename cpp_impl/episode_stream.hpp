@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "episode.hpp"
+#include "episode_file.hpp"
+#include "replay_buffer.hpp"
+
+// One pass over episode files that don't fit in memory. A prefetch thread
+// reads the files in order, `block` episodes at a time, into the back half
+// of a double buffer while training drains the front half into a shuffle
+// window of `window` episodes; `next` hands out a random episode of the
+// window. Memory stays at `window + 2 * block` episodes whatever the size
+// of the files, and training only waits on disk when the window runs dry.
+// Shuffling is local to the window, so files should not be sorted by
+// anything that matters.
+class EpisodeStream {
+ public:
+  EpisodeStream(std::vector<std::string> files, size_t window = 4096,
+                size_t block = 256, unsigned seed = std::random_device{}())
+      : files(std::move(files)),
+        window_size(std::max<size_t>(window, 1)),
+        block_size(std::max<size_t>(block, 1)),
+        gen(seed) {
+    producer = std::thread([this] { produce(); });
+  }
+  ~EpisodeStream() {
+    {
+      std::lock_guard lock(block_mutex);
+      stop = true;
+    }
+    block_free.notify_all();
+    producer.join();
+  }
+  EpisodeStream(const EpisodeStream&) = delete;
+  EpisodeStream& operator=(const EpisodeStream&) = delete;
+
+  // the next episode in window-shuffled order; false once every file has
+  // been read and the window is empty. Safe to call from several threads.
+  bool next(Episode& ep) {
+    std::lock_guard lock(window_mutex);
+    if (window.size() < window_size) refill(window.empty());
+    if (window.empty()) return false;
+    std::uniform_int_distribution<size_t> dist(0, window.size() - 1);
+    std::swap(window[dist(gen)], window.back());
+    ep = std::move(window.back());
+    window.pop_back();
+    return true;
+  }
+
+ private:
+  std::vector<std::string> files;
+  size_t window_size, block_size;
+  std::mt19937 gen;
+
+  std::mutex window_mutex;
+  std::vector<Episode> window;
+
+  // the double buffer: the producer fills its own block and swaps it with
+  // `ready` once the consumer has taken the previous one
+  std::mutex block_mutex;
+  std::condition_variable block_ready, block_free;
+  std::vector<Episode> ready;
+  bool has_ready = false, done = false, stop = false;
+  std::thread producer;
+
+  // move the ready block into the window; waits for it only if `wait`
+  void refill(bool wait) {
+    std::unique_lock lock(block_mutex);
+    if (wait) block_ready.wait(lock, [&] { return has_ready || done; });
+    if (!has_ready) return;
+    for (auto& ep : ready) window.push_back(std::move(ep));
+    ready.clear();
+    has_ready = false;
+    lock.unlock();
+    block_free.notify_one();
+  }
+  // false if the stream is being destroyed
+  bool hand_over(std::vector<Episode>& block) {
+    std::unique_lock lock(block_mutex);
+    block_free.wait(lock, [&] { return !has_ready || stop; });
+    if (stop) return false;
+    std::swap(ready, block);
+    has_ready = true;
+    lock.unlock();
+    block_ready.notify_one();
+    block.clear();
+    return true;
+  }
+  void produce() {
+    std::vector<Episode> block;
+    block.reserve(block_size);
+    bool running = true;
+    auto add = [&](const Episode& ep) {
+      if (!running) return;
+      block.push_back(ep);
+      if (block.size() == block_size) running = hand_over(block);
+    };
+    for (const auto& file : files) {
+      if (!running) break;
+      if (is_episode_file(file)) {
+        EpisodeReader(file).for_each([&](const Episode& ep, uint64_t) {
+          add(ep);
+        });
+      } else {
+        ReplayBuffer::read_text(file, [&](const Episode& ep, int) { add(ep); });
+      }
+    }
+    if (running && !block.empty()) hand_over(block);
+    {
+      std::lock_guard lock(block_mutex);
+      done = true;
+    }
+    block_ready.notify_all();
+  }
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+
+#include "board.hpp"
+
+// Direct-mapped cache of network evaluations keyed by the canonical
+// `Board::hash()`, which is valid because the networks sum over all 8
+// symmetries. Safe to share between search threads without locks: a slot
+// stores `key ^ data` next to `data`, so a torn write fails the key check and
+// reads as a miss.
+class EvalCache {
+ public:
+  EvalCache(int log2_size = 16)
+      : shift(64 - log2_size), table(new Entry[size_t(1) << log2_size]){};
+
+  bool probe(Board::Hash key, Board::Reward& value) const {
+    const Entry& e = table[index(key)];
+    uint64_t data = e.data.load(std::memory_order_relaxed);
+    uint64_t check = e.check.load(std::memory_order_relaxed);
+    if ((check ^ data) != key ||
+        uint32_t(data >> 32) != generation.load(std::memory_order_relaxed))
+      return false;
+    value = std::bit_cast<Board::Reward>(uint32_t(data));
+    return true;
+  }
+  void store(Board::Hash key, Board::Reward value) {
+    Entry& e = table[index(key)];
+    uint64_t data =
+        uint64_t(generation.load(std::memory_order_relaxed)) << 32 |
+        std::bit_cast<uint32_t>(value);
+    e.check.store(key ^ data, std::memory_order_relaxed);
+    e.data.store(data, std::memory_order_relaxed);
+  }
+  // invalidate every entry in O(1), e.g. after the model is reloaded
+  void clear() { generation.fetch_add(1, std::memory_order_relaxed); }
+
+ private:
+  struct Entry {
+    std::atomic<uint64_t> check{0};
+    std::atomic<uint64_t> data{0};
+  };
+  size_t index(Board::Hash key) const {
+    return (key * 0x9e3779b97f4a7c15ull) >> shift;
+  }
+
+  int shift;
+  std::unique_ptr<Entry[]> table;
+  // starts at 1 so zero-initialized slots never match
+  std::atomic<uint32_t> generation{1};
+};
@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "board.hpp"
+#include "episode.hpp"
+#include "net.hpp"
+#include "replay_buffer.hpp"
+#include "training.hpp"
+
+// Tuple layout search: the trajectories are loaded once and shared read-only
+// by a pool of threads, each training one candidate layout at a time with
+// TD(0). Candidates are pruned by successive halving: every round the
+// survivors train `epochs * eta^round` more epochs and only the best 1/eta by
+// test loss go on, until `keep` are left. The survivors are then timed and
+// reported by test loss and by evaluation cost.
+using FeatLayout = std::array<std::array<int, 3>, 8>;
+
+// the 3 rows, 3 columns and 2 diagonals, the layout of the shipped model
+const FeatLayout line_layout = {{{0, 1, 2},
+                                 {3, 4, 5},
+                                 {6, 7, 8},
+                                 {0, 3, 6},
+                                 {1, 4, 7},
+                                 {2, 5, 8},
+                                 {0, 4, 8},
+                                 {2, 4, 6}}};
+
+// `count` distinct layouts of distinct sorted 3-cell tuples, the line
+// layout first
+std::vector<FeatLayout> random_layouts(size_t count, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::set<FeatLayout> seen;
+  std::vector<FeatLayout> layouts;
+  auto add = [&](FeatLayout l) {
+    FeatLayout key = l;
+    std::sort(key.begin(), key.end());
+    if (seen.insert(key).second) layouts.push_back(l);
+  };
+  add(line_layout);
+  while (layouts.size() < count) {
+    std::set<std::array<int, 3>> feats;
+    while (feats.size() < 8) {
+      std::array<int, 9> cells = {0, 1, 2, 3, 4, 5, 6, 7, 8};
+      std::shuffle(cells.begin(), cells.end(), gen);
+      std::array<int, 3> f = {cells[0], cells[1], cells[2]};
+      std::sort(f.begin(), f.end());
+      feats.insert(f);
+    }
+    FeatLayout l;
+    std::copy(feats.begin(), feats.end(), l.begin());
+    add(l);
+  }
+  return layouts;
+}
+
+template <class Net>
+struct Candidate {
+  FeatLayout layout;
+  std::unique_ptr<Net> net;
+  std::mt19937 gen;
+  size_t epochs = 0;
+  Board::Reward loss = 0;
+  double eval_ns = 0;
+  double update_ns = 0;
+};
+
+template <class Net>
+void search(const EpisodeSet& train_set, const EpisodeSet& test_set,
+            const std::vector<FeatLayout>& layouts, int threads, size_t epochs,
+            size_t eta, size_t keep, Board::Reward lr) {
+  std::vector<Candidate<Net>> candidates(layouts.size());
+  for (size_t c = 0; c < layouts.size(); c++) {
+    candidates[c].layout = layouts[c];
+    candidates[c].gen.seed(c);
+  }
+  std::vector<Candidate<Net>*> alive;
+  for (auto& c : candidates) alive.push_back(&c);
+
+  // a candidate's nets and episode order are only touched by the thread
+  // training it, the buffers are shared read-only
+  auto train = [&](Candidate<Net>& c, size_t rounds) {
+    if (!c.net) c.net = std::make_unique<Net>(c.layout);
+    std::vector<uint32_t> order(train_set.size());
+    std::iota(order.begin(), order.end(), 0);
+    for (size_t e = 0; e < rounds; e++) {
+      std::shuffle(order.begin(), order.end(), c.gen);
+      for (auto i : order) {
+        td_episode(*c.net, train_set[i],
+                   [&](const Board& b, Board::Reward error) {
+                     c.net->update_net(b, error, lr);
+                   });
+      }
+    }
+    c.epochs += rounds;
+    c.loss = test_loss(*c.net, test_set);
+  };
+
+  using clock = std::chrono::steady_clock;
+  const auto start = clock::now();
+  for (size_t round = 0, budget = epochs;; round++, budget *= eta) {
+    std::atomic<size_t> next = 0;
+    auto worker = [&] {
+      for (size_t j; (j = next.fetch_add(1)) < alive.size();) {
+        train(*alive[j], budget);
+      }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) pool.emplace_back(worker);
+    for (auto& t : pool) t.join();
+
+    std::sort(alive.begin(), alive.end(),
+              [](auto* a, auto* b) { return a->loss < b->loss; });
+    std::chrono::duration<double> wall = clock::now() - start;
+    std::cout.precision(4);
+    std::cout << "Round " << round << " ( " << wall.count() << " sec) || "
+              << alive.size() << " candidates x " << budget
+              << " epochs || best test loss: " << alive.front()->loss
+              << " || worst: " << alive.back()->loss << std::endl;
+    if (alive.size() <= keep) break;
+    const size_t survivors = std::max(keep, (alive.size() + eta - 1) / eta);
+    // a dense TupleNet<3,8> is 32 MB, so pruned tables go right away
+    for (size_t j = survivors; j < alive.size(); j++) alive[j]->net.reset();
+    alive.resize(survivors);
+  }
+
+  // timed one at a time on the calling thread, so the numbers compare
+  const auto boards = test_set.states(7);
+  for (auto* c : alive) {
+    std::vector<Board::Reward> values(boards.size());
+    auto begin = clock::now();
+    for (size_t j = 0; j < boards.size(); j++) {
+      values[j] = c->net->evaluate(boards[j]);
+    }
+    std::chrono::duration<double> t = clock::now() - begin;
+    c->eval_ns = t.count() * 1e9 / boards.size();
+    // lr 0 leaves the trained tables as they are
+    begin = clock::now();
+    for (size_t j = 0; j < boards.size(); j++) {
+      c->net->update_net(boards[j], values[j], 0);
+    }
+    t = clock::now() - begin;
+    c->update_ns = t.count() * 1e9 / boards.size();
+  }
+
+  auto print = [&](const char* title) {
+    std::cout << title << std::endl;
+    for (auto* c : alive) {
+      std::cout << "  test loss " << std::setw(8) << c->loss << " | eval "
+                << std::setw(6) << c->eval_ns << " ns | update "
+                << std::setw(6) << c->update_ns << " ns | {";
+      for (const auto& f : c->layout) {
+        std::cout << "{" << f[0] << "," << f[1] << "," << f[2] << "}";
+      }
+      std::cout << "}" << (c->layout == line_layout ? " (lines)" : "")
+                << std::endl;
+    }
+  };
+  print("Best layouts by test loss:");
+  std::stable_sort(alive.begin(), alive.end(), [](auto* a, auto* b) {
+    return a->eval_ns + a->update_ns < b->eval_ns + b->update_ns;
+  });
+  print("Best layouts by evaluation cost:");
+}
+
+// options: net=newnet|tuple, candidates=N, threads=N, epochs=N (first round),
+// eta=N (keep 1/eta per round), keep=N (stop at N survivors), lr=X, seed=N,
+// files=N, pattern=S (trajectory/<i><pattern>.episode), capacity=N
+int main(int argc, const char* argv[]) {
+  std::copy(argv, argv + argc,
+            std::ostream_iterator<const char*>(std::cout, " "));
+  std::cout << std::endl;
+  std::string net = "newnet";
+  size_t count = 32;
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t epochs = 1, eta = 2, keep = 4;
+  Board::Reward lr = 0.001;
+  unsigned seed = 0;
+  int files = 30;
+  std::string pattern = "_0M1k50000sim";
+  size_t capacity = 6000;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto match_arg = [&](std::string flag) -> bool {
+      auto it = arg.find_first_not_of('-');
+      return arg.find(flag, it) == it;
+    };
+    auto next_opt = [&]() -> std::string {
+      auto it = arg.find('=') + 1;
+      return it ? arg.substr(it) : argv[++i];
+    };
+    if (match_arg("net")) {
+      net = next_opt();
+    } else if (match_arg("candidates")) {
+      count = std::max(1ull, std::stoull(next_opt()));
+    } else if (match_arg("threads")) {
+      threads = std::max(1, std::stoi(next_opt()));
+    } else if (match_arg("epochs")) {
+      epochs = std::max(1ull, std::stoull(next_opt()));
+    } else if (match_arg("eta")) {
+      eta = std::max(2ull, std::stoull(next_opt()));
+    } else if (match_arg("keep")) {
+      keep = std::max(1ull, std::stoull(next_opt()));
+    } else if (match_arg("lr")) {
+      lr = std::stof(next_opt());
+    } else if (match_arg("seed")) {
+      seed = std::stoul(next_opt());
+    } else if (match_arg("files")) {
+      files = std::stoi(next_opt());
+    } else if (match_arg("pattern")) {
+      pattern = next_opt();
+    } else if (match_arg("capacity")) {
+      capacity = std::stoull(next_opt());
+    }
+  }
+
+  ReplayBuffer buffer(capacity);
+  std::vector<std::string> paths;
+  for (int i = 0; i < files; i++) {
+    paths.push_back("trajectory/" + std::to_string(i) + pattern + ".episode");
+  }
+  buffer.load(paths, threads);
+  auto episodes = buffer.episodes();
+  episodes.shuffle();
+  auto&& [train_set, test_set] = episodes.split(0.8);
+  std::cout << train_set.size() << " train / " << test_set.size()
+            << " test episodes" << std::endl;
+
+  const auto layouts = random_layouts(count, seed);
+  if (net == "tuple") {
+    search<TupleNet<3, 8, BucketIndex>>(train_set, test_set, layouts, threads,
+                                        epochs, eta, keep, lr);
+  } else {
+    search<NewNet<3, 8>>(train_set, test_set, layouts, threads, epochs, eta,
+                         keep, lr);
+  }
+}
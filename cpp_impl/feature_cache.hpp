@@ -0,0 +1,81 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "board.hpp"
+#include "replay_buffer.hpp"
+
+// The table indices (`Net::get_feats`) of every state of a set of episodes,
+// computed once, so a training epoch only gathers and scatters instead of
+// rebuilding the 8 symmetric boards of each state twice per pass. Each
+// episode is a contiguous run of `size + 1` entries, the initial board
+// first, with the reward of the move into each state alongside. Valid for
+// as long as the net's feature layout doesn't change.
+template <class Net>
+class FeatureCache {
+ public:
+  using Feats = typename Net::Feats;
+
+  // one episode: `feats[t + 1]` and `rewards[t + 1]` are step t's
+  struct View {
+    std::span<const Feats> feats;
+    std::span<const Board::Reward> rewards;
+    size_t size() const { return feats.size() - 1; }
+  };
+
+  FeatureCache(const Net& net, const EpisodeSet& set, int threads) {
+    offsets.resize(set.size() + 1);
+    offsets[0] = 0;
+    for (size_t i = 0; i < set.size(); i++) {
+      offsets[i + 1] = offsets[i] + set[i].size() + 1;
+    }
+    feats.resize(offsets.back());
+    rewards.resize(offsets.back());
+    auto worker = [&](int tid) {
+      for (size_t i = tid; i < set.size(); i += threads) {
+        const auto ep = set[i];
+        Feats* f = &feats[offsets[i]];
+        Board::Reward* r = &rewards[offsets[i]];
+        f[0] = net.get_feats(ep.init_state);
+        r[0] = 0;
+        for (size_t t = 0; t < ep.size(); t++) {
+          f[t + 1] = net.get_feats(ep.state(t));
+          r[t + 1] = ep.reward(t);
+        }
+      }
+    };
+    std::vector<std::thread> pool;
+    for (int tid = 1; tid < threads; tid++) pool.emplace_back(worker, tid);
+    worker(0);
+    for (auto& t : pool) t.join();
+    order.resize(set.size());
+    std::iota(order.begin(), order.end(), 0);
+  }
+
+  size_t size() const { return order.size(); }
+  View operator[](size_t i) const {
+    const size_t j = order[i];
+    const size_t first = offsets[j], n = offsets[j + 1] - first;
+    return {{&feats[first], n}, {&rewards[first], n}};
+  }
+  void shuffle() {
+    thread_local std::mt19937 gen(std::random_device{}());
+    std::shuffle(order.begin(), order.end(), gen);
+  }
+  size_t bytes() const {
+    return feats.size() * sizeof(Feats) +
+           rewards.size() * sizeof(Board::Reward) +
+           offsets.size() * sizeof(size_t) + order.size() * sizeof(uint32_t);
+  }
+
+ private:
+  std::vector<Feats> feats;
+  std::vector<Board::Reward> rewards;
+  std::vector<size_t> offsets;
+  std::vector<uint32_t> order;
+};
@@ -0,0 +1,199 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <utility>
+
+#include "board.hpp"
+#include "model_file.hpp"
+#include "net.hpp"
+
+// NewNet and TupleNet with the tuple layout as a template argument, e.g.
+// `FixedNewNet<Layout<3, 8>{{{0, 1, 2}, ...}}>`. Every symmetry/feature/cell
+// to board-cell mapping is a constant, so the index computation unrolls into
+// straight-line shifts and masks. The runtime-configurable classes stay for
+// layout experiments; both read and write the same model files.
+template <int FEAT_SIZE, int FEAT_NUM>
+using Layout = std::array<std::array<int, FEAT_SIZE>, FEAT_NUM>;
+
+// board cell read by cell `j` of feature `k` on symmetric board `s`
+template <auto FEATS>
+inline constexpr auto layout_cells = [] {
+  using Feat = typename decltype(FEATS)::value_type;
+  std::array<std::array<Feat, FEATS.size()>, 8> cells = {};
+  for (int s = 0; s < 8; s++) {
+    for (size_t k = 0; k < FEATS.size(); k++) {
+      for (size_t j = 0; j < FEATS[k].size(); j++) {
+        cells[s][k][j] = Board::isom_table[s][FEATS[k][j]];
+      }
+    }
+  }
+  return cells;
+}();
+
+template <auto FEATS>
+class FixedNewNet {
+ public:
+  static constexpr int FEAT_NUM = FEATS.size();
+  static constexpr int FEAT_SIZE = FEATS[0].size();
+
+  FixedNewNet() { values.fill(0.0f); };
+  // a zero net if the file can't be loaded
+  FixedNewNet(const std::string& load_path) : FixedNewNet() {
+    valid = load(load_path);
+  }
+
+  std::array<uint32_t, 8> get_feats(const Board& b) const {
+    return [&]<size_t... S>(std::index_sequence<S...>) {
+      return std::array<uint32_t, 8>{index<S>(b)...};
+    }(std::make_index_sequence<8>{});
+  }
+  Board::Reward evaluate(const Board& b) const {
+    Board::Reward value = 0;
+    for (const auto& feat : get_feats(b)) {
+      value += values[feat];
+    }
+    return value;
+  };
+  void update_net(const Board& b, const Board::Reward error,
+                  const Board::Reward lr) {
+    for (const auto& feat : get_feats(b)) {
+      values[feat] += lr * error / (8);
+    }
+  };
+
+  bool load(const std::string& load_path) {
+    ModelFile file(load_path, header());
+    if (!file.is_valid()) return false;
+    if (!std::equal(file.layout(), file.layout() + FEAT_SIZE * FEAT_NUM,
+                    FEATS[0].data())) {
+      std::cout << "Layout of " << load_path << " does not match" << std::endl;
+      return false;
+    }
+    std::copy_n(file.table(0), values.size(), values.data());
+    return valid = true;
+  };
+  bool is_valid() const { return valid; }
+  void save(const std::string& save_path) const {
+    const Board::Reward* table = values.data();
+    write_model(save_path, header(), {FEATS[0].data(), FEAT_SIZE * FEAT_NUM},
+                {&table, 1});
+  };
+
+ public:
+  std::array<Board::Reward, static_cast<int>(std::pow(3, FEAT_NUM))> values;
+
+ private:
+  bool valid = true;
+  static ModelHeader header() {
+    return {.feat_size = FEAT_SIZE,
+            .feat_num = FEAT_NUM,
+            .num_range = 3,
+            .table_num = 1,
+            .table_size = std::tuple_size_v<decltype(values)>};
+  }
+  template <size_t S>
+  static uint32_t index(const Board& b) {
+    return [&]<size_t... K>(std::index_sequence<K...>) {
+      uint32_t idx = 0;
+      ((idx = idx * 3 + digit<S, K>(b)), ...);
+      return idx;
+    }(std::make_index_sequence<FEAT_NUM>{});
+  }
+  template <size_t S, size_t K>
+  static uint32_t digit(const Board& b) {
+    return [&]<size_t... J>(std::index_sequence<J...>) {
+      return uint32_t((b.get(layout_cells<FEATS>[S][K][J]) ^ ...) % 3);
+    }(std::make_index_sequence<FEAT_SIZE>{});
+  }
+};
+
+template <auto FEATS, class Index = DenseIndex>
+class FixedTupleNet {
+ public:
+  static constexpr int FEAT_NUM = FEATS.size();
+  static constexpr int FEAT_SIZE = FEATS[0].size();
+  static constexpr int NUM_RANGE = Index::range;
+  static constexpr size_t net_size =
+      static_cast<size_t>(std::pow(NUM_RANGE, FEAT_SIZE));
+
+  FixedTupleNet() {
+    for (auto& v : values) {
+      v = std::make_unique<Board::Reward[]>(net_size);
+    }
+    weights.fill(1.0f);
+  };
+  FixedTupleNet(const std::string& load_path) : FixedTupleNet() {
+    valid = load(load_path);
+  }
+
+  // `feats[i * 8 + isom]`, the same order as `TupleNet::get_feats`
+  std::array<uint32_t, FEAT_NUM * 8> get_feats(const Board& b) const {
+    return [&]<size_t... I>(std::index_sequence<I...>) {
+      return std::array<uint32_t, FEAT_NUM * 8>{index<I % 8, I / 8>(b)...};
+    }(std::make_index_sequence<FEAT_NUM * 8>{});
+  }
+  Board::Reward evaluate(const Board& b) const {
+    const auto feats = get_feats(b);
+    Board::Reward value = 0;
+    for (int i = 0; i < FEAT_NUM; i++) {
+      Board::Reward sum = 0;
+      for (int isom = 0; isom < 8; isom++) sum += values[i][feats[i * 8 + isom]];
+      value += sum * weights[i];
+    }
+    return value;
+  };
+  void update_net(const Board& b, const Board::Reward error,
+                  const Board::Reward lr) {
+    const auto feats = get_feats(b);
+    for (int k = 0; k < FEAT_NUM * 8; k++) {
+      values[k / 8][feats[k]] += lr * error / (FEAT_NUM * 8);
+    }
+  };
+
+  bool load(const std::string& load_path) {
+    ModelFile file(load_path, header());
+    if (!file.is_valid()) return false;
+    if (!std::equal(file.layout(), file.layout() + FEAT_SIZE * FEAT_NUM,
+                    FEATS[0].data())) {
+      std::cout << "Layout of " << load_path << " does not match" << std::endl;
+      return false;
+    }
+    for (int i = 0; i < FEAT_NUM; i++) values[i] = file.share(i);
+    return valid = true;
+  };
+  bool is_valid() const { return valid; }
+  void save(const std::string& save_path) const {
+    std::array<const Board::Reward*, FEAT_NUM> tables;
+    for (int i = 0; i < FEAT_NUM; i++) tables[i] = values[i].get();
+    write_model(save_path, header(), {FEATS[0].data(), FEAT_SIZE * FEAT_NUM},
+                tables);
+  };
+
+ public:
+  std::array<Table<Board::Reward>, FEAT_NUM> values;
+  std::array<Board::Reward, FEAT_NUM> weights;
+
+ private:
+  bool valid = true;
+  static ModelHeader header() {
+    return {.feat_size = FEAT_SIZE,
+            .feat_num = FEAT_NUM,
+            .num_range = NUM_RANGE,
+            .table_num = FEAT_NUM,
+            .table_size = net_size};
+  }
+  template <size_t S, size_t K>
+  static uint32_t index(const Board& b) {
+    return [&]<size_t... J>(std::index_sequence<J...>) {
+      uint32_t idx = 0;
+      ((idx = idx * NUM_RANGE +
+              Index::map(b.get(layout_cells<FEATS>[S][K][J]))),
+       ...);
+      return idx;
+    }(std::make_index_sequence<FEAT_SIZE>{});
+  }
+};
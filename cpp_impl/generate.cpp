@@ -1,12 +1,26 @@
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
 
 #include "agent.hpp"
 #include "board.hpp"
 #include "episode.hpp"
+#include "episode_file.hpp"
 #include "utils.hpp"
 
-// use `mcts_player` generate `episode`, and save them in file, with format like
+// use `mcts_player` generate `episode`, and save them in file, in the binary
+// episode format (episode_file.hpp) or, with `text`, one line per episode like
 // this: state(uint64_t) action(int) state(uint64_t) action(int) ...
+//
+// threads=N workers play in this process, each with its own pair of players
+// reused across episodes and its own generator (seed=S makes worker k's games
+// reproducible from S + k). Episodes go to one file through a shared buffered
+// writer, in the order they finish.
 int main(int argc, const char* argv[]) {
   std::srand(std::time(nullptr));
   std::copy(argv, argv + argc,
@@ -15,6 +29,9 @@ int main(int argc, const char* argv[]) {
   size_t total = 1'000'000, block = 10000;
   size_t sim_count = 10000;
   std::string id = "";
+  bool text = false;
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+  uint64_t seed = std::random_device{}();
 
   for (int i = 1; i < argc; i++) {
     std::string arg = argv[i];
@@ -34,19 +51,52 @@ int main(int argc, const char* argv[]) {
       block = std::stoull(next_opt());
     } else if (match_arg("id")) {
       id = next_opt();
+    } else if (match_arg("text")) {
+      text = true;
+    } else if (match_arg("threads")) {
+      threads = std::max(1, std::stoi(next_opt()));
+    } else if (match_arg("seed")) {
+      seed = std::stoull(next_opt());
     }
   }
   std::string save_path = "trajectory/" + id + "_" +
                           std::to_string(total / 1000000) + "M" +
                           std::to_string(total / 1000) + "k" +
                           std::to_string(sim_count) + "sim.episode";
-  for (int i = 1; i < total; i++) {
-    if (i % block == 0) {
-      std::cout << "block " << i / block << std::endl;
-    }
+  std::unique_ptr<EpisodeWriter> writer;
+  if (!text) {
+    writer = std::make_unique<EpisodeWriter>(save_path);
+    if (!writer->is_open()) return 1;
+  }
+  std::atomic<size_t> next = 1;
+  std::mutex out_mutex;
+  auto worker = [&](int tid) {
+    Board::seed_rng(seed + tid);
     auto p1 = mcts_player(sim_count);
     auto p2 = mcts_player(sim_count);
-    auto ep = PlayAnEpisode(p1, p2);
-    ep.save(i, save_path);
-  }
-}
\ No newline at end of file
+    for (size_t i; (i = next.fetch_add(1)) < total;) {
+      auto ep = PlayAnEpisode(p1, p2);
+      std::lock_guard lock(out_mutex);
+      if (i % block == 0) {
+        std::cout << "block " << i / block << std::endl;
+      }
+      if (writer) {
+        writer->write(ep, i);
+      } else {
+        ep.save(i, save_path);
+      }
+    }
+  };
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> pool;
+  for (int tid = 1; tid < threads; tid++) pool.emplace_back(worker, tid);
+  worker(0);
+  for (auto& t : pool) t.join();
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  const size_t played = total > 1 ? total - 1 : 0;
+  std::cout << "Generated " << played << " episodes in " << seconds << " sec, "
+            << played / seconds << " episodes/sec with " << threads
+            << " threads" << std::endl;
+}
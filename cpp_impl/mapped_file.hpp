@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Copy-on-write mapping of a whole file: pages are shared with every other
+// process mapping the same file until written, and writes never reach the
+// file.
+class MappedFile {
+ public:
+  MappedFile(const std::string& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    HANDLE mapping = size.QuadPart ? CreateFileMappingA(file, nullptr,
+                                                        PAGE_WRITECOPY, 0, 0,
+                                                        nullptr)
+                                   : nullptr;
+    CloseHandle(file);
+    if (!mapping) return;
+    void* p = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!p) return;
+    bytes = static_cast<char*>(p);
+    length = size.QuadPart;
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void* p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                     fd, 0);
+      if (p != MAP_FAILED) {
+        bytes = static_cast<char*>(p);
+        length = st.st_size;
+      }
+    }
+    ::close(fd);
+#endif
+  }
+  ~MappedFile() {
+    if (!bytes) return;
+#ifdef _WIN32
+    UnmapViewOfFile(bytes);
+#else
+    munmap(bytes, length);
+#endif
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool is_open() const { return bytes != nullptr; }
+  char* data() const { return bytes; }
+  size_t size() const { return length; }
+
+ private:
+  char* bytes = nullptr;
+  size_t length = 0;
+};
@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "board.hpp"
+#include "stats.hpp"
 #include "utils.hpp"
 
 class Node {
@@ -105,19 +106,51 @@ class Node {
   }
 };
 
+// one select/expand/rollout/backpropagate step, timed into `stats`
+void mcts_iteration(Node* root, SearchStats& stats) {
+#ifdef NO_SEARCH_STATS
+  Node* selected = root->select();
+  selected->expand();
+  Board::Reward score = selected->rollout();
+  selected->backpropagate(score);
+#else
+  auto t0 = SearchStats::Clock::now();
+  Node* selected = root->select();
+  auto t1 = SearchStats::Clock::now();
+  selected->expand();
+  auto t2 = SearchStats::Clock::now();
+  Board::Reward score = selected->rollout();
+  auto t3 = SearchStats::Clock::now();
+  selected->backpropagate(score);
+  auto t4 = SearchStats::Clock::now();
+
+  int depth = 0;
+  for (Node* n = selected; n != root; n = n->parent) depth++;
+  stats.simulations++;
+  stats.depth_sum += depth;
+  stats.max_depth = std::max(stats.max_depth, depth);
+  stats.tree_size += selected->children.size();
+  stats.select_ns += SearchStats::ns(t1 - t0);
+  stats.expand_ns += SearchStats::ns(t2 - t1);
+  stats.rollout_ns += SearchStats::ns(t3 - t2);
+  stats.backprop_ns += SearchStats::ns(t4 - t3);
+#endif
+}
+
 Board::Action monte_carlo_tree_search(const Board& state, int sim_count,
-                                      int time_limit) {
+                                      int time_limit,
+                                      SearchStats* stats = nullptr) {
+  SearchStats local;
+  SearchStats& s = stats ? *stats : local;
   auto start = std::chrono::steady_clock::now();
   Node* root = new Node(state);
   root->expand();
+  STATS(s.tree_size += 1 + root->children.size());
 
   while (std::chrono::steady_clock::now() - start <
              std::chrono::seconds(time_limit) &&
          sim_count-- > 0) {
-    Node* selected = root->select();
-    selected->expand();
-    Board::Reward score = selected->rollout();
-    selected->backpropagate(score);
+    mcts_iteration(root, s);
   }
 
   Board::Reward best_reward = -std::numeric_limits<Board::Reward>::infinity();
@@ -133,15 +166,16 @@ Board::Action monte_carlo_tree_search(const Board& state, int sim_count,
   return best_action;
 }
 
-Board::Reward mcts_estimate(const Board& state, int sim_count) {
+Board::Reward mcts_estimate(const Board& state, int sim_count,
+                            SearchStats* stats = nullptr) {
+  SearchStats local;
+  SearchStats& s = stats ? *stats : local;
   Node* root = new Node(state);
   root->expand();
+  STATS(s.tree_size += 1 + root->children.size());
 
   for (int i = 0; i < sim_count; i++) {
-    Node* selected = root->select();
-    selected->expand();
-    Board::Reward score = selected->rollout();
-    selected->backpropagate(score);
+    mcts_iteration(root, s);
   }
 
   Board::Reward best_reward = -std::numeric_limits<Board::Reward>::infinity();
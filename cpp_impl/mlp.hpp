@@ -1,137 +1,671 @@
+#pragma once
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <random>
+#include <span>
+#include <string>
 #include <vector>
 
+#include "board.hpp"
+#include "net.hpp"
+
+#ifdef NET_X86
+#define NET_VNNI __attribute__((target("avx2,avxvnni")))
+inline const bool cpu_has_vnni = [] {
+  __builtin_cpu_init();
+  return cpu_has_avx2 && __builtin_cpu_supports("avxvnni");
+}();
+#endif
+
+// Fully connected value network: ReLU hidden layers and one linear output.
+// It has the same evaluate / update_net / *_batch / save / load interface as
+// NewNet and TupleNet, so train.cpp and the players can use either.
+//
+// Each layer's weights are row-major `in x stride`, row k holding input k's
+// weights to every output, with `stride` the output width rounded up to 8
+// floats and zero padding. A forward pass broadcasts one input at a time and
+// adds its row into the outputs, so there are no horizontal sums. Activations
+// of a batch are one padded row per board.
+//
+// Inference skips the encoding: at most 3 of a cell's 6 inputs are nonzero,
+// so the first layer adds those weight rows straight from the board.
+//
+// `quantize(Precision::Int8, boards)` adds an int8 copy of every later layer
+// for inference: weights scaled per output, ReLU inputs scaled per layer to
+// 0..127 from the activations the calibration boards produce. 0..127 keeps
+// the AVX2 u8 x i8 pair sums within int16; with AVX-VNNI the 4-way dot
+// products go straight to int32.
 class MLP {
  public:
-  MLP(const std::vector<int>& layerSizes);
-  std::vector<double> forward(const std::vector<double>& input);
-  void train(const std::vector<std::vector<double>>& inputs,
-             const std::vector<std::vector<double>>& targets, int epochs,
-             double learningRate);
+  // per cell: value / 128, value == 0, one-hot of value % 4
+  static constexpr int cell_features = 6;
+  static constexpr int input_size = 9 * cell_features;
+
+  // `hidden` are the hidden layer widths, e.g. {64, 32}
+  MLP(const std::vector<int>& hidden = {64, 32}, unsigned seed = 0);
+  MLP(std::initializer_list<int> hidden, unsigned seed = 0)
+      : MLP(std::vector<int>(hidden), seed){};
+  // the default net if the file can't be loaded
+  MLP(const std::string& load_path) : MLP() { valid = load(load_path); }
+
+  static void encode(const Board& b, float* x);
+
+  // `x` is `batch` padded input rows, `y` gets one value per row
+  void forward(const float* x, int batch, float* y) const;
+  // One SGD step on the squared error of `batch` rows: each output moves by
+  // `lr * errors[j]` along its gradient, like NewNet's table update. The
+  // per-row gradients are summed, not averaged.
+  void backward(const float* x, int batch, const Board::Reward* errors,
+                Board::Reward lr);
+
+  Board::Reward evaluate(const Board& b) const;
+  void update_net(const Board& b, const Board::Reward error,
+                  const Board::Reward lr);
+  void evaluate_batch(std::span<const Board> boards,
+                      std::span<Board::Reward> out) const;
+  // one SGD step on the whole batch, not `boards.size()` sequential steps
+  void update_batch(std::span<const Board> boards,
+                    std::span<const Board::Reward> errors,
+                    const Board::Reward lr);
+
+  // Float32, or Int8 for inference calibrated on `calibration`. The float
+  // weights stay the master copy and `update_net` requantizes the int8
+  // weights after each step, keeping the calibrated activation scales.
+  void quantize(Precision p, std::span<const Board> calibration = {});
+
+  // false, with the net left as it was, if the file can't be loaded
+  bool load(const std::string& load_path);
+  // false if the constructor's file couldn't be loaded
+  bool is_valid() const { return valid; }
+  void save(const std::string& save_path) const;
+
+ public:
+  // input, hidden..., 1
+  std::vector<int> layer_sizes;
+  Precision precision = Precision::Float32;
 
  private:
-  std::vector<std::vector<double>> weights;
-  std::vector<std::vector<double>> biases;
-  std::vector<int> layerSizes;
-  void backward(const std::vector<double>& input,
-                const std::vector<double>& target, double learningRate);
+  struct Layer {
+    int in, out, stride;
+    std::vector<float> w, b;
+    std::vector<float> dw, db;
+    // int8 copy: input k of output o at qw[((k / 4) * stride + o) * 4 + k % 4]
+    // so 8 outputs x 4 inputs are one 32-byte vector; y = acc * qscale + b
+    std::vector<int8_t> qw;
+    std::vector<float> qscale;
+    float in_scale = 1;
+  };
+  std::vector<Layer> layers;
+  // training activations and gradients, one padded buffer per layer
+  std::vector<std::vector<float>> acts, grads;
+  bool valid = true;
+
+  static int padded(int n) { return (n + 7) & ~7; }
+  void build(const std::vector<int>& sizes);
+  int max_width() const;
+  // int8 weights of `l` from its float weights and `in_scale`
+  static void quantize_weights(Layer& l);
+  // boards -> out, through the thread's scratch buffers
+  void run(std::span<const Board> boards, Board::Reward* out) const;
+  // first layer of `encode(b)` without materializing it, ReLU'd
+  void input_layer(const Board& b, float* y) const;
+
+  // y[j] = b + sum_k x[j][k] * w[k], optionally ReLU'd; rows of x are
+  // padded(in) wide and rows of y `stride` wide
+  static void dense(const Layer& l, const float* x, int batch, float* y,
+                    bool relu);
+  // int8 `dense` for layers after the first
+  static void dense_q(const Layer& l, const float* x, int batch, float* y,
+                      bool relu);
+  // y += a * x over `n` floats, n a multiple of 8
+  static void axpy(float a, const float* x, float* y, int n);
+  // x . y over `n` floats, n a multiple of 8
+  static float dot(const float* x, const float* y, int n);
+#ifdef NET_X86
+  NET_AVX2 static void dense_avx2(const Layer& l, const float* x, int batch,
+                                  float* y, bool relu);
+  template <int NV>
+  NET_AVX2 static void dense_block_avx2(const Layer& l, const float* x,
+                                        int o0, float* y);
+  NET_AVX2 static void axpy_avx2(float a, const float* x, float* y, int n);
+  NET_AVX2 static float dot_avx2(const float* x, const float* y, int n);
+  template <int NV>
+  NET_AVX2 static void dense_q_block_avx2(const Layer& l, const uint8_t* x,
+                                          int o0, float* y);
+  template <int NV>
+  NET_VNNI static void dense_q_block_vnni(const Layer& l, const uint8_t* x,
+                                          int o0, float* y);
+  // x (>= 0) / scale rounded and clamped to 0..127, n a multiple of 8
+  NET_AVX2 static void quantize_row_avx2(const float* x, int n, float inv,
+                                         uint8_t* q);
+  NET_AVX2 static void store_q(const Layer& l, const __m256i* acc, int nv,
+                               int o0, float* y);
+  NET_AVX2 static void dense_q_avx2(const Layer& l, const uint8_t* x,
+                                    float* y);
+  NET_VNNI static void dense_q_vnni(const Layer& l, const uint8_t* x,
+                                    float* y);
+#endif
 };
 
-MLP::MLP(const std::vector<int>& layerSizes) : layerSizes(layerSizes) {
-  // Initialize weights and biases for each layer
-  for (int i = 1; i < layerSizes.size(); ++i) {
-    int prevLayerSize = layerSizes[i - 1];
-    int currentLayerSize = layerSizes[i];
+inline MLP::MLP(const std::vector<int>& hidden, unsigned seed) {
+  std::vector<int> sizes = {input_size};
+  sizes.insert(sizes.end(), hidden.begin(), hidden.end());
+  sizes.push_back(1);
+  build(sizes);
+  // He initialization for the ReLU layers, small output layer
+  std::mt19937 gen(seed);
+  for (size_t i = 0; i < layers.size(); i++) {
+    auto& l = layers[i];
+    const bool last = i + 1 == layers.size();
+    std::normal_distribution<float> dist(
+        0.0f, last ? 0.01f : std::sqrt(2.0f / l.in));
+    for (int k = 0; k < l.in; k++) {
+      for (int o = 0; o < l.out; o++) l.w[k * l.stride + o] = dist(gen);
+    }
+  }
+}
 
-    std::vector<double> layerWeights(prevLayerSize * currentLayerSize);
-    std::vector<double> layerBiases(currentLayerSize);
+inline void MLP::build(const std::vector<int>& sizes) {
+  layer_sizes = sizes;
+  layers.clear();
+  for (size_t i = 1; i < sizes.size(); i++) {
+    Layer l;
+    l.in = sizes[i - 1];
+    l.out = sizes[i];
+    l.stride = padded(l.out);
+    l.w.assign(size_t(l.in) * l.stride, 0.0f);
+    l.b.assign(l.stride, 0.0f);
+    l.dw.assign(l.w.size(), 0.0f);
+    l.db.assign(l.stride, 0.0f);
+    layers.push_back(std::move(l));
+  }
+  acts.assign(sizes.size(), {});
+  grads.assign(sizes.size(), {});
+}
 
-    // Initialize weights and biases (e.g., random initialization)
-    // ...
+inline int MLP::max_width() const {
+  int s = 0;
+  for (auto n : layer_sizes) s = std::max(s, padded(n));
+  return s;
+}
 
-    weights.push_back(layerWeights);
-    biases.push_back(layerBiases);
+inline void MLP::encode(const Board& b, float* x) {
+  for (int c = 0; c < 9; c++) {
+    const int v = b.get(c);
+    float* f = x + c * cell_features;
+    f[0] = v * (1.0f / 128);
+    f[1] = v == 0;
+    for (int m = 0; m < 4; m++) f[2 + m] = v % 4 == m;
   }
+  std::fill(x + input_size, x + padded(input_size), 0.0f);
 }
 
-std::vector<double> MLP::forward(const std::vector<double>& input) {
-  std::vector<double> activations = input;
+inline void MLP::forward(const float* x, int batch, float* y) const {
+  // ping-pong between two scratch buffers, the input is read in place
+  thread_local std::vector<float> buf[2];
+  const size_t need = size_t(batch) * max_width();
+  for (auto& v : buf) {
+    if (v.size() < need) v.resize(need);
+  }
+  const float* in = x;
+  for (size_t i = 0; i < layers.size(); i++) {
+    float* out = buf[i % 2].data();
+    dense(layers[i], in, batch, out, i + 1 < layers.size());
+    in = out;
+  }
+  const int top = layers.back().stride;
+  for (int j = 0; j < batch; j++) y[j] = in[j * top];
+}
 
-  // Perform forward propagation through each layer
-  for (int i = 0; i < layerSizes.size() - 1; ++i) {
-    int inputSize = layerSizes[i];
-    int outputSize = layerSizes[i + 1];
+inline void MLP::input_layer(const Board& b, float* y) const {
+  const Layer& l = layers[0];
+  const bool relu = layers.size() > 1;
+  std::copy(l.b.begin(), l.b.end(), y);
+  for (int c = 0; c < 9; c++) {
+    const int v = b.get(c);
+    const int k = c * cell_features;
+    axpy(v * (1.0f / 128), &l.w[k * l.stride], y, l.stride);
+    if (v == 0) axpy(1.0f, &l.w[(k + 1) * l.stride], y, l.stride);
+    axpy(1.0f, &l.w[(k + 2 + v % 4) * l.stride], y, l.stride);
+  }
+  if (relu) {
+    for (int o = 0; o < l.stride; o++) y[o] = std::max(y[o], 0.0f);
+  }
+}
 
-    std::vector<double> nextActivations(outputSize);
+inline void MLP::backward(const float* x, int batch,
+                          const Board::Reward* errors, Board::Reward lr) {
+  const int n = layers.size();
+  for (int i = 0; i <= n; i++) {
+    const size_t need = size_t(batch) * padded(layer_sizes[i]);
+    if (i && acts[i].size() < need) acts[i].resize(need);
+    if (grads[i].size() < need) grads[i].resize(need);
+  }
+  // forward, keeping every layer's activations
+  const float* in = x;
+  for (int i = 0; i < n; i++) {
+    dense(layers[i], in, batch, acts[i + 1].data(), i + 1 < n);
+    in = acts[i + 1].data();
+  }
+  // d(loss)/d(output) = -(error), with loss = error^2 / 2
+  const int top = layers.back().stride;
+  std::fill(grads[n].begin(), grads[n].begin() + batch * top, 0.0f);
+  for (int j = 0; j < batch; j++) grads[n][j * top] = -errors[j];
 
-    // Compute activations for the next layer
-    for (int j = 0; j < outputSize; ++j) {
-      double activation = biases[i][j];
-      for (int k = 0; k < inputSize; ++k) {
-        activation += activations[k] * weights[i][k * outputSize + j];
+  for (int i = n - 1; i >= 0; i--) {
+    auto& l = layers[i];
+    const float* x_in = i ? acts[i].data() : x;
+    const int x_stride = padded(l.in);
+    const float* dy = grads[i + 1].data();
+    std::fill(l.dw.begin(), l.dw.end(), 0.0f);
+    std::fill(l.db.begin(), l.db.end(), 0.0f);
+    for (int j = 0; j < batch; j++) {
+      const float* xj = &x_in[j * x_stride];
+      const float* dyj = &dy[j * l.stride];
+      axpy(1.0f, dyj, l.db.data(), l.stride);
+      // dw[k] += x[j][k] * dy[j]; dx[j][k] = w[k] . dy[j] where x > 0, so
+      // zero inputs and dead ReLUs cost nothing either way
+      float* dx = i ? &grads[i][j * x_stride] : nullptr;
+      for (int k = 0; k < l.in; k++) {
+        if (dx) dx[k] = 0.0f;
+        if (xj[k] == 0.0f) continue;
+        axpy(xj[k], dyj, &l.dw[k * l.stride], l.stride);
+        if (dx && xj[k] > 0.0f) dx[k] = dot(&l.w[k * l.stride], dyj, l.stride);
       }
-      nextActivations[j] =
-          std::max(0.0, activation);  // ReLU activation function
+      if (dx) std::fill(dx + l.in, dx + x_stride, 0.0f);
     }
+    axpy(-lr, l.dw.data(), l.w.data(), l.w.size());
+    axpy(-lr, l.db.data(), l.b.data(), l.stride);
+  }
+}
 
-    activations = nextActivations;
+inline void MLP::run(std::span<const Board> boards, Board::Reward* out) const {
+  thread_local std::vector<float> buf[2];
+  const size_t need = boards.size() * max_width();
+  for (auto& v : buf) {
+    if (v.size() < need) v.resize(need);
+  }
+  const int stride = layers[0].stride;
+  for (size_t j = 0; j < boards.size(); j++) {
+    input_layer(boards[j], &buf[0][j * stride]);
+  }
+  const float* in = buf[0].data();
+  for (size_t i = 1; i < layers.size(); i++) {
+    float* y = buf[i % 2].data();
+    const bool relu = i + 1 < layers.size();
+    if (precision == Precision::Int8) {
+      dense_q(layers[i], in, boards.size(), y, relu);
+    } else {
+      dense(layers[i], in, boards.size(), y, relu);
+    }
+    in = y;
   }
+  const int top = layers.back().stride;
+  for (size_t j = 0; j < boards.size(); j++) out[j] = in[j * top];
+}
 
-  return activations;
+inline Board::Reward MLP::evaluate(const Board& b) const {
+  Board::Reward value;
+  run({&b, 1}, &value);
+  return value;
 }
 
-void MLP::backward(const std::vector<double>& input, const std::vector<double>& target, double learningRate) {
-    std::vector<std::vector<double>> layerActivations(layerSizes.size());
-    std::vector<std::vector<double>> layerGradients(layerSizes.size());
+inline void MLP::evaluate_batch(std::span<const Board> boards,
+                                std::span<Board::Reward> out) const {
+  run(boards, out.data());
+}
 
-    // Perform forward pass and store layer activations
-    layerActivations[0] = input;
-    for (int i = 0; i < layerSizes.size() - 1; ++i) {
-        const std::vector<double>& activations = layerActivations[i];
-        std::vector<double>& nextActivations = layerActivations[i + 1];
+inline void MLP::update_net(const Board& b, const Board::Reward error,
+                            const Board::Reward lr) {
+  update_batch({&b, 1}, {&error, 1}, lr);
+}
 
-        nextActivations.resize(layerSizes[i + 1]);
+inline void MLP::update_batch(std::span<const Board> boards,
+                              std::span<const Board::Reward> errors,
+                              const Board::Reward lr) {
+  thread_local std::vector<float> x;
+  const int stride = padded(input_size);
+  if (x.size() < boards.size() * stride) x.resize(boards.size() * stride);
+  for (size_t j = 0; j < boards.size(); j++) encode(boards[j], &x[j * stride]);
+  backward(x.data(), boards.size(), errors.data(), lr);
+  if (precision == Precision::Int8) {
+    for (size_t i = 1; i < layers.size(); i++) quantize_weights(layers[i]);
+  }
+}
 
-        // Compute activations for the next layer
-        for (int j = 0; j < layerSizes[i + 1]; ++j) {
-            double activation = biases[i][j];
-            for (int k = 0; k < layerSizes[i]; ++k) {
-                activation += activations[k] * weights[i][k * layerSizes[i + 1] + j];
-            }
-            nextActivations[j] = std::max(0.0, activation);  // ReLU activation function
-        }
+inline void MLP::quantize(Precision p, std::span<const Board> calibration) {
+  precision = Precision::Float32;
+  if (p != Precision::Int8) return;
+  if (calibration.empty()) {
+    std::cout << "MLP int8 needs calibration boards" << std::endl;
+    return;
+  }
+  // largest input each layer sees over the calibration set, in float
+  std::vector<float> max_in(layers.size(), 0.0f);
+  std::vector<float> y(max_width()), a(max_width());
+  for (const auto& b : calibration) {
+    input_layer(b, a.data());
+    for (size_t i = 1; i < layers.size(); i++) {
+      const auto& l = layers[i];
+      for (int k = 0; k < l.in; k++) max_in[i] = std::max(max_in[i], a[k]);
+      dense(l, a.data(), 1, y.data(), i + 1 < layers.size());
+      std::swap(a, y);
     }
+  }
+  for (size_t i = 1; i < layers.size(); i++) {
+    auto& l = layers[i];
+    l.in_scale = max_in[i] > 0 ? max_in[i] / 127 : 1;
+    quantize_weights(l);
+  }
+  precision = Precision::Int8;
+}
 
-    // Compute gradients for the output layer
-    const std::vector<double>& outputActivations = layerActivations.back();
-    std::vector<double>& outputGradients = layerGradients.back();
-    for (int i = 0; i < layerSizes.back(); ++i) {
-        outputGradients[i] = outputActivations[i] - target[i];
+inline void MLP::quantize_weights(Layer& l) {
+  const int groups = padded(l.in) / 4;
+  l.qw.assign(size_t(groups) * l.stride * 4, 0);
+  l.qscale.assign(l.stride, 0.0f);
+  for (int o = 0; o < l.out; o++) {
+    float max_w = 0;
+    for (int k = 0; k < l.in; k++) {
+      max_w = std::max(max_w, std::abs(l.w[k * l.stride + o]));
+    }
+    const float ws = max_w > 0 ? max_w / 127 : 1;
+    l.qscale[o] = ws * l.in_scale;
+    for (int k = 0; k < l.in; k++) {
+      l.qw[((k / 4) * l.stride + o) * 4 + k % 4] = int8_t(
+          std::clamp(std::round(l.w[k * l.stride + o] / ws), -127.0f, 127.0f));
     }
+  }
+}
 
-    // Perform backward pass to compute gradients for hidden layers
-    for (int i = layerSizes.size() - 2; i >= 0; --i) {
-        const std::vector<double>& activations = layerActivations[i];
-        const std::vector<double>& nextGradients = layerGradients[i + 1];
-        std::vector<double>& gradients = layerGradients[i];
-        std::vector<double>& weightUpdates = weights[i];
+// int layer count, int sizes[count], then per layer the `in x out` weights
+// (unpadded, row-major) followed by the `out` biases
+inline bool MLP::load(const std::string& load_path) {
+  std::ifstream ifs(load_path, std::ios::binary);
+  if (!ifs.is_open()) {
+    std::cout << "Cannot open file " << load_path << std::endl;
+    return false;
+  }
+  // bounds on what a model file may declare, checked before allocating
+  static constexpr int max_layers = 16, max_size = 4096;
+  int count = 0;
+  ifs.read(reinterpret_cast<char*>(&count), sizeof(int));
+  std::vector<int> sizes;
+  if (ifs && count >= 2 && count <= max_layers) {
+    sizes.resize(count);
+    ifs.read(reinterpret_cast<char*>(sizes.data()), sizeof(int) * count);
+  }
+  if (!ifs || sizes.empty() || sizes[0] != input_size || sizes.back() != 1 ||
+      std::any_of(sizes.begin(), sizes.end(),
+                  [](int n) { return n < 1 || n > max_size; })) {
+    std::cout << "Invalid MLP model " << load_path << std::endl;
+    return false;
+  }
+  auto previous = std::move(layers);
+  const auto previous_sizes = layer_sizes;
+  build(sizes);
+  for (auto& l : layers) {
+    for (int k = 0; k < l.in; k++) {
+      ifs.read(reinterpret_cast<char*>(&l.w[k * l.stride]),
+               sizeof(float) * l.out);
+    }
+    ifs.read(reinterpret_cast<char*>(l.b.data()), sizeof(float) * l.out);
+  }
+  if (!ifs) {
+    std::cout << "Truncated MLP model " << load_path << std::endl;
+    build(previous_sizes);
+    layers = std::move(previous);
+    return false;
+  }
+  precision = Precision::Float32;
+  return valid = true;
+}
 
-        gradients.resize(layerSizes[i]);
+inline void MLP::save(const std::string& save_path) const {
+  std::ofstream ofs(save_path,
+                    std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!ofs.is_open()) {
+    std::cout << "Cannot open file " << save_path << std::endl;
+    return;
+  }
+  const int count = layer_sizes.size();
+  ofs.write(reinterpret_cast<const char*>(&count), sizeof(int));
+  ofs.write(reinterpret_cast<const char*>(layer_sizes.data()),
+            sizeof(int) * count);
+  for (auto& l : layers) {
+    for (int k = 0; k < l.in; k++) {
+      ofs.write(reinterpret_cast<const char*>(&l.w[k * l.stride]),
+                sizeof(float) * l.out);
+    }
+    ofs.write(reinterpret_cast<const char*>(l.b.data()), sizeof(float) * l.out);
+  }
+}
 
-        for (int j = 0; j < layerSizes[i]; ++j) {
-            double gradient = 0.0;
-            for (int k = 0; k < layerSizes[i + 1]; ++k) {
-                gradient += nextGradients[k] * weights[i][j * layerSizes[i + 1] + k];
-            }
-            gradients[j] = (activations[j] > 0.0) ? gradient : 0.0;  // ReLU derivative
-        }
+inline void MLP::dense(const Layer& l, const float* x, int batch, float* y,
+                       bool relu) {
+#ifdef NET_X86
+  if (cpu_has_avx2) return dense_avx2(l, x, batch, y, relu);
+#endif
+  const int x_stride = padded(l.in);
+  for (int j = 0; j < batch; j++) {
+    const float* xj = &x[j * x_stride];
+    float* yj = &y[j * l.stride];
+    std::copy(l.b.begin(), l.b.end(), yj);
+    for (int k = 0; k < l.in; k++) {
+      const float* w = &l.w[k * l.stride];
+      for (int o = 0; o < l.stride; o++) yj[o] += xj[k] * w[o];
+    }
+    if (relu) {
+      for (int o = 0; o < l.stride; o++) yj[o] = std::max(yj[o], 0.0f);
+    }
+  }
+}
 
-        // Update weights
-        for (int j = 0; j < layerSizes[i]; ++j) {
-            for (int k = 0; k < layerSizes[i + 1]; ++k) {
-                weightUpdates[j * layerSizes[i + 1] + k] -= learningRate * activations[j] * nextGradients[k];
-            }
+inline void MLP::dense_q(const Layer& l, const float* x, int batch, float* y,
+                         bool relu) {
+  const int x_stride = padded(l.in);
+  thread_local std::vector<uint8_t> xq;
+  if (xq.size() < size_t(x_stride)) xq.resize(x_stride);
+  const float inv = 1.0f / l.in_scale;
+  for (int j = 0; j < batch; j++) {
+    const float* xj = &x[j * x_stride];
+    float* yj = &y[j * l.stride];
+#ifdef NET_X86
+    if (cpu_has_avx2) {
+      quantize_row_avx2(xj, x_stride, inv, xq.data());
+      if (cpu_has_vnni) {
+        dense_q_vnni(l, xq.data(), yj);
+      } else {
+        dense_q_avx2(l, xq.data(), yj);
+      }
+    } else
+#endif
+    {
+      for (int k = 0; k < x_stride; k++) {
+        xq[k] = uint8_t(std::min(127.0f, std::nearbyint(xj[k] * inv)));
+      }
+      for (int o = 0; o < l.stride; o++) {
+        int32_t acc = 0;
+        for (int k = 0; k < x_stride; k++) {
+          acc += xq[k] * l.qw[((k / 4) * l.stride + o) * 4 + k % 4];
         }
+        yj[o] = acc * l.qscale[o] + l.b[o];
+      }
+    }
+    if (relu) {
+      for (int o = 0; o < l.stride; o++) yj[o] = std::max(yj[o], 0.0f);
     }
+  }
+}
+
+inline void MLP::axpy(float a, const float* x, float* y, int n) {
+#ifdef NET_X86
+  if (cpu_has_avx2) return axpy_avx2(a, x, y, n);
+#endif
+  for (int k = 0; k < n; k++) y[k] += a * x[k];
+}
 
-    // Apply weight updates
-    for (int i = 0; i < weights.size(); ++i) {
-        std::vector<double>& layerWeights = weights[i];
-        const std::vector<double>& weightUpdates = weightUpdateGradients[i];
+inline float MLP::dot(const float* x, const float* y, int n) {
+#ifdef NET_X86
+  if (cpu_has_avx2) return dot_avx2(x, y, n);
+#endif
+  float sum = 0;
+  for (int k = 0; k < n; k++) sum += x[k] * y[k];
+  return sum;
+}
 
-        for (int j = 0; j < layerWeights.size(); ++j) {
-            layerWeights[j] += weightUpdates[j];
+#ifdef NET_X86
+// outputs in blocks of up to 8 vectors kept in registers for the whole row;
+// the block's weights (in x 64 floats, 14 KB for the input layer) stay in
+// L1 across the batch
+NET_AVX2 inline void MLP::dense_avx2(const Layer& l, const float* x, int batch,
+                                     float* y, bool relu) {
+  const int x_stride = padded(l.in);
+  for (int o0 = 0; o0 < l.stride; o0 += 64) {
+    const int nv = std::min(8, (l.stride - o0) / 8);
+    for (int j = 0; j < batch; j++) {
+      const float* xj = &x[j * x_stride];
+      float* yj = &y[j * l.stride];
+      switch (nv) {
+        case 1: dense_block_avx2<1>(l, xj, o0, yj); break;
+        case 2: dense_block_avx2<2>(l, xj, o0, yj); break;
+        case 3: dense_block_avx2<3>(l, xj, o0, yj); break;
+        case 4: dense_block_avx2<4>(l, xj, o0, yj); break;
+        case 5: dense_block_avx2<5>(l, xj, o0, yj); break;
+        case 6: dense_block_avx2<6>(l, xj, o0, yj); break;
+        case 7: dense_block_avx2<7>(l, xj, o0, yj); break;
+        default: dense_block_avx2<8>(l, xj, o0, yj); break;
+      }
+      if (relu) {
+        for (int v = 0; v < nv; v++) {
+          float* p = yj + o0 + v * 8;
+          _mm256_storeu_ps(p, _mm256_max_ps(_mm256_loadu_ps(p),
+                                            _mm256_setzero_ps()));
         }
+      }
+    }
+  }
+}
+
+template <int NV>
+NET_AVX2 inline void MLP::dense_block_avx2(const Layer& l, const float* x,
+                                           int o0, float* y) {
+  __m256 acc[NV];
+  for (int v = 0; v < NV; v++) acc[v] = _mm256_loadu_ps(&l.b[o0 + v * 8]);
+  for (int k = 0; k < l.in; k++) {
+    const __m256 xk = _mm256_set1_ps(x[k]);
+    const float* w = &l.w[k * l.stride + o0];
+    for (int v = 0; v < NV; v++) {
+      acc[v] = _mm256_add_ps(acc[v],
+                             _mm256_mul_ps(xk, _mm256_loadu_ps(w + v * 8)));
     }
+  }
+  for (int v = 0; v < NV; v++) _mm256_storeu_ps(y + o0 + v * 8, acc[v]);
 }
 
-void MLP::train(const std::vector<std::vector<double>>& inputs, const std::vector<std::vector<double>>& targets, int epochs, double learningRate) {
-    for (int epoch = 0; epoch < epochs; ++epoch) {
-        for (int i = 0; i < inputs.size(); ++i) {
-            const std::vector<double>& input = inputs[i];
-            const std::vector<double>& target = targets[i];
+// 4 inputs at a time against 8 outputs x 4 weights: maddubs (u8 x i8 pairs
+// to int16) plus madd (pairs to int32) on plain AVX2, one vpdpbusd with
+// AVX-VNNI. Outputs go in blocks of 4 vectors, then single vectors.
+template <int NV>
+NET_AVX2 inline void MLP::dense_q_block_avx2(const Layer& l, const uint8_t* x,
+                                             int o0, float* y) {
+  __m256i acc[NV];
+  for (int v = 0; v < NV; v++) acc[v] = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+  for (int g = 0; g < padded(l.in) / 4; g++) {
+    int32_t x4;
+    std::memcpy(&x4, x + g * 4, 4);
+    const __m256i xb = _mm256_set1_epi32(x4);
+    const int8_t* w = &l.qw[(size_t(g) * l.stride + o0) * 4];
+    for (int v = 0; v < NV; v++) {
+      const __m256i wv =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + v * 32));
+      acc[v] = _mm256_add_epi32(
+          acc[v], _mm256_madd_epi16(_mm256_maddubs_epi16(xb, wv), ones));
+    }
+  }
+  store_q(l, acc, NV, o0, y);
+}
 
-            backward(input, target, learningRate);
-        }
+template <int NV>
+NET_VNNI inline void MLP::dense_q_block_vnni(const Layer& l, const uint8_t* x,
+                                             int o0, float* y) {
+  __m256i acc[NV];
+  for (int v = 0; v < NV; v++) acc[v] = _mm256_setzero_si256();
+  for (int g = 0; g < padded(l.in) / 4; g++) {
+    int32_t x4;
+    std::memcpy(&x4, x + g * 4, 4);
+    const __m256i xb = _mm256_set1_epi32(x4);
+    const int8_t* w = &l.qw[(size_t(g) * l.stride + o0) * 4];
+    for (int v = 0; v < NV; v++) {
+      acc[v] = _mm256_dpbusd_avx_epi32(
+          acc[v], xb,
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + v * 32)));
     }
+  }
+  store_q(l, acc, NV, o0, y);
+}
+
+NET_AVX2 inline void MLP::quantize_row_avx2(const float* x, int n, float inv,
+                                            uint8_t* q) {
+  const __m256 scale = _mm256_set1_ps(inv);
+  const __m256i max = _mm256_set1_epi32(127);
+  for (int k = 0; k < n; k += 8) {
+    __m256i v = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(x + k), scale));
+    v = _mm256_min_epi32(v, max);
+    const __m128i w = _mm_packus_epi32(_mm256_castsi256_si128(v),
+                                       _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(q + k),
+                     _mm_packus_epi16(w, w));
+  }
+}
+
+NET_AVX2 inline void MLP::store_q(const Layer& l, const __m256i* acc, int nv,
+                                  int o0, float* y) {
+  for (int v = 0; v < nv; v++) {
+    const int o = o0 + v * 8;
+    const __m256 r = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_cvtepi32_ps(acc[v]),
+                      _mm256_loadu_ps(&l.qscale[o])),
+        _mm256_loadu_ps(&l.b[o]));
+    _mm256_storeu_ps(y + o, r);
+  }
+}
+
+NET_AVX2 inline void MLP::dense_q_avx2(const Layer& l, const uint8_t* x,
+                                       float* y) {
+  int o0 = 0;
+  for (; o0 + 32 <= l.stride; o0 += 32) dense_q_block_avx2<4>(l, x, o0, y);
+  for (; o0 < l.stride; o0 += 8) dense_q_block_avx2<1>(l, x, o0, y);
+}
+
+NET_VNNI inline void MLP::dense_q_vnni(const Layer& l, const uint8_t* x,
+                                       float* y) {
+  int o0 = 0;
+  for (; o0 + 32 <= l.stride; o0 += 32) dense_q_block_vnni<4>(l, x, o0, y);
+  for (; o0 < l.stride; o0 += 8) dense_q_block_vnni<1>(l, x, o0, y);
+}
+
+NET_AVX2 inline void MLP::axpy_avx2(float a, const float* x, float* y,
+                                    int n) {
+  const __m256 av = _mm256_set1_ps(a);
+  for (int k = 0; k < n; k += 8) {
+    const __m256 xk = _mm256_loadu_ps(x + k);
+    _mm256_storeu_ps(y + k,
+                     _mm256_add_ps(_mm256_loadu_ps(y + k), _mm256_mul_ps(av, xk)));
+  }
+}
+
+NET_AVX2 inline float MLP::dot_avx2(const float* x, const float* y, int n) {
+  __m256 acc = _mm256_setzero_ps();
+  for (int k = 0; k < n; k += 8) {
+    acc = _mm256_add_ps(
+        acc, _mm256_mul_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(y + k)));
+  }
+  return hsum_avx2(acc);
 }
+#endif
@@ -0,0 +1,222 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "board.hpp"
+#include "mapped_file.hpp"
+
+// Model file layout, version 1:
+//
+//   ModelHeader                     64 bytes
+//   feature layout                  feat_num * feat_size int32
+//   table 0 .. table_num - 1        table_size float32 each, every table
+//                                   starting on a 64 byte boundary
+//
+// so a mapping of the file can be used as the tables in place. Files that
+// don't start with `model_magic` are the older headerless layout (feature
+// layout immediately followed by the tables), which is still read.
+inline constexpr char model_magic[8] = {'2', '0', '4', '8', 'N', 'E', 'T', 0};
+inline constexpr uint32_t model_version = 1;
+inline constexpr uint64_t model_align = 64;
+
+struct ModelHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t feat_size;
+  uint32_t feat_num;
+  // values per cell in a table index, 3 for NewNet digits
+  uint32_t num_range;
+  uint32_t table_num;
+  uint32_t entry_bytes;
+  uint64_t table_size;
+  uint64_t table_offset;
+  uint64_t table_stride;
+  // over the layout and the tables, see `model_checksum`
+  uint64_t checksum;
+};
+static_assert(sizeof(ModelHeader) == 64);
+
+// 64-bit FNV-1a over 8 byte words; `n` is a multiple of 4, a trailing half
+// word is zero-padded
+inline uint64_t model_checksum(const void* data, size_t n,
+                               uint64_t h = 0xcbf29ce484222325ull) {
+  const char* p = static_cast<const char*>(data);
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t w;
+    std::memcpy(&w, p, 8);
+    h = (h ^ w) * 0x100000001b3ull;
+  }
+  if (n) {
+    uint64_t w = 0;
+    std::memcpy(&w, p, n);
+    h = (h ^ w) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+// Deleter for tables that may live in a mapped model file: owned tables are
+// delete[]d, mapped ones only drop their reference to the mapping.
+struct TableDeleter {
+  std::shared_ptr<const MappedFile> mapping;
+  TableDeleter() = default;
+  TableDeleter(std::shared_ptr<const MappedFile> mapping)
+      : mapping(std::move(mapping)) {}
+  template <class T>
+  TableDeleter(std::default_delete<T[]>) {}
+  template <class T>
+  void operator()(T* p) const {
+    if (!mapping) delete[] p;
+  }
+};
+template <class T>
+using Table = std::unique_ptr<T[], TableDeleter>;
+
+// A model file opened for reading. The expected shape is checked against the
+// header (or the file size, for headerless files); `table(i)` points into the
+// mapping. The checksum pass reads every page of the file, so opening
+// doesn't run it unless `verify` is set; `verify()` runs it later.
+class ModelFile {
+ public:
+  ModelFile(const std::string& path, const ModelHeader& expect,
+            bool verify = false)
+      : path(path), mapping(std::make_shared<const MappedFile>(path)) {
+    if (!mapping->is_open()) {
+      std::cout << "Cannot open file " << path << std::endl;
+      return;
+    }
+    const char* p = mapping->data();
+    const size_t layout_bytes =
+        size_t(expect.feat_num) * expect.feat_size * sizeof(int32_t);
+    const size_t table_bytes = expect.table_size * sizeof(Board::Reward);
+    if (mapping->size() < sizeof(ModelHeader) ||
+        std::memcmp(p, model_magic, sizeof(model_magic)) != 0) {
+      header = expect;
+      header.version = 0;
+      header.table_offset = layout_bytes;
+      header.table_stride = table_bytes;
+      if (mapping->size() != layout_bytes + expect.table_num * table_bytes) {
+        std::cout << "Invalid model " << path << std::endl;
+        return;
+      }
+      valid = true;
+      return;
+    }
+    std::memcpy(&header, p, sizeof(ModelHeader));
+    if (header.version != model_version) {
+      std::cout << "Unsupported model version " << header.version << " in "
+                << path << std::endl;
+      return;
+    }
+    if (header.feat_size != expect.feat_size ||
+        header.feat_num != expect.feat_num ||
+        header.num_range != expect.num_range ||
+        header.table_num != expect.table_num ||
+        header.table_size != expect.table_size ||
+        header.entry_bytes != sizeof(Board::Reward) ||
+        header.table_offset % model_align || header.table_stride % model_align ||
+        header.table_offset + header.table_num * header.table_stride >
+            mapping->size()) {
+      std::cout << "Model " << path << " does not match this net" << std::endl;
+      return;
+    }
+    valid = !verify || this->verify();
+  }
+
+  bool is_valid() const { return valid; }
+  // whether the layout and tables match the header's checksum; headerless
+  // files have none and always pass
+  bool verify() const {
+    if (!header.version) return true;
+    const size_t table_bytes = header.table_size * sizeof(Board::Reward);
+    const size_t layout_bytes =
+        size_t(header.feat_num) * header.feat_size * sizeof(int32_t);
+    uint64_t h = model_checksum(layout(), layout_bytes);
+    for (uint32_t i = 0; i < header.table_num; i++) {
+      h = model_checksum(table(i), table_bytes, h);
+    }
+    if (h != header.checksum) {
+      std::cout << "Checksum mismatch in " << path << std::endl;
+      return false;
+    }
+    return true;
+  }
+  const int32_t* layout() const {
+    return reinterpret_cast<const int32_t*>(
+        mapping->data() + (header.version ? sizeof(ModelHeader) : 0));
+  }
+  Board::Reward* table(int i) const {
+    return reinterpret_cast<Board::Reward*>(
+        mapping->data() + header.table_offset + i * header.table_stride);
+  }
+  // `table(i)` as a `Table` that keeps the mapping alive
+  Table<Board::Reward> share(int i) const {
+    return Table<Board::Reward>(table(i), TableDeleter(mapping));
+  }
+
+  ModelHeader header;
+  std::string path;
+  std::shared_ptr<const MappedFile> mapping;
+
+ private:
+  bool valid = false;
+};
+
+// Write a model in the current format. `header` gives the shape, the rest is
+// filled in here. The file is written next to `save_path` and renamed over
+// it, so a process that has the old file mapped keeps reading the old
+// tables and readers never see a half-written model.
+inline bool write_model(const std::string& save_path, ModelHeader header,
+                        std::span<const int32_t> layout,
+                        std::span<const Board::Reward* const> tables) {
+  auto align = [](uint64_t n) {
+    return (n + model_align - 1) / model_align * model_align;
+  };
+  const size_t layout_bytes = layout.size_bytes();
+  const size_t table_bytes = header.table_size * sizeof(Board::Reward);
+  std::memcpy(header.magic, model_magic, sizeof(model_magic));
+  header.version = model_version;
+  header.table_num = tables.size();
+  header.entry_bytes = sizeof(Board::Reward);
+  header.table_offset = align(sizeof(ModelHeader) + layout_bytes);
+  header.table_stride = align(table_bytes);
+  header.checksum = model_checksum(layout.data(), layout_bytes);
+  for (const auto* t : tables) {
+    header.checksum = model_checksum(t, table_bytes, header.checksum);
+  }
+
+  const std::string tmp_path = save_path + ".tmp";
+  std::ofstream ofs(tmp_path,
+                    std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!ofs.is_open()) {
+    std::cout << "Cannot open file " << tmp_path << std::endl;
+    return false;
+  }
+  const char zeros[model_align] = {};
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(ModelHeader));
+  ofs.write(reinterpret_cast<const char*>(layout.data()), layout_bytes);
+  ofs.write(zeros, header.table_offset - sizeof(ModelHeader) - layout_bytes);
+  for (const auto* t : tables) {
+    ofs.write(reinterpret_cast<const char*>(t), table_bytes);
+    ofs.write(zeros, header.table_stride - table_bytes);
+  }
+  ofs.close();
+  if (!ofs) {
+    std::cout << "Cannot write file " << tmp_path << std::endl;
+    return false;
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, save_path, ec);
+  if (ec) {
+    std::cout << "Cannot replace file " << save_path << std::endl;
+    return false;
+  }
+  return true;
+}
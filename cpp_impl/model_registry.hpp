@@ -0,0 +1,36 @@
+#pragma once
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// The process-wide read-only copy of the model at `path`, loaded on first
+// use and shared by every caller after that, so players built in a loop
+// don't each reread the file. The file's modification time is checked on
+// every call and a rewritten model is loaded again; holders of the old one
+// keep it until they let go. A file that can't be loaded gives nullptr and
+// isn't cached, so the next call tries again.
+template <class Net>
+std::shared_ptr<const Net> shared_model(const std::string& path) {
+  struct Entry {
+    std::filesystem::file_time_type mtime;
+    std::shared_ptr<const Net> net;
+  };
+  static std::mutex mutex;
+  static std::unordered_map<std::string, Entry> models;
+  std::error_code ec;
+  const auto mtime = std::filesystem::last_write_time(path, ec);
+  if (ec) {
+    std::cout << "Cannot open file " << path << std::endl;
+    return nullptr;
+  }
+  std::lock_guard lock(mutex);
+  auto it = models.find(path);
+  if (it != models.end() && it->second.mtime == mtime) return it->second.net;
+  auto net = std::make_shared<const Net>(path);
+  if (!net->is_valid()) return nullptr;
+  models[path] = {mtime, net};
+  return net;
+}
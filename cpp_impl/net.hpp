@@ -1,55 +1,228 @@
 #pragma once
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <numeric>
 #include <random>
+#include <span>
 #include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#define NET_X86
+#include <immintrin.h>
+#endif
 
 #include "board.hpp"
+#include "model_file.hpp"
 #include "utils.hpp"
 
+// The AVX2 paths are compiled with target attributes and picked at run time,
+// so the plain `-O3` build still uses them on capable machines.
+#ifdef NET_X86
+#define NET_AVX2 __attribute__((target("avx2,f16c")))
+inline const bool cpu_has_avx2 = [] {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+}();
+#endif
+
+// cells of the 8 symmetric boards, cell-major so one row is one SIMD vector
+template <class Map>
+inline void isomorphic_cells(const Board& b, uint32_t (&cells)[9][8],
+                             Map map) {
+  const auto isoms = b.isomorphisms();
+  for (int c = 0; c < 9; c++) {
+    for (int s = 0; s < 8; s++) {
+      cells[c][s] = map(isoms[s].get(c));
+    }
+  }
+}
+
+// Which features a move touches, for incremental evaluation: a move on `line`
+// (action % 6) changes the features in bitmask `touched[line][s]` of
+// symmetric board s, and feature i of board s reads original cells
+// `cells[s][i]`.
 template <int FEAT_SIZE, int FEAT_NUM>
+struct UpdatePlan {
+  static_assert(FEAT_NUM <= 64);
+  std::array<std::array<uint64_t, 8>, 6> touched;
+  std::array<std::array<std::array<int, FEAT_SIZE>, FEAT_NUM>, 8> cells;
+
+  void build(const std::array<std::array<int, FEAT_SIZE>, FEAT_NUM>& feat_idx) {
+    Board id;
+    for (int c = 0; c < 9; c++) id.set(c, c);
+    const auto isoms = id.isomorphisms();
+    for (auto& t : touched) t.fill(0);
+    for (int s = 0; s < 8; s++) {
+      for (int i = 0; i < FEAT_NUM; i++) {
+        for (int j = 0; j < FEAT_SIZE; j++) {
+          const int c = isoms[s].get(feat_idx[i][j]);
+          cells[s][i][j] = c;
+          for (int line = 0; line < 6; line++) {
+            for (const auto& l : Board::idxs[line]) {
+              if (l == c) touched[line][s] |= uint64_t(1) << i;
+            }
+          }
+        }
+      }
+    }
+  }
+};
+
+// Table writes of the update paths. Hogwild workers update shared tables
+// without locks, so entries are read and written with relaxed atomics: a
+// concurrent update to the same entry may be lost, but it is not a data
+// race. On x86 these are the same plain moves as before.
+template <class T>
+inline T add_relaxed(T& entry, T delta) {
+  std::atomic_ref<T> ref(entry);
+  const T v = ref.load(std::memory_order_relaxed) + delta;
+  ref.store(v, std::memory_order_relaxed);
+  return v;
+}
+template <class T>
+inline void store_relaxed(T& entry, T v) {
+  std::atomic_ref<T>(entry).store(v, std::memory_order_relaxed);
+}
+
+// storage of the inference tables, see `TupleNet::quantize`
+enum class Precision { Float32, Int16, Float16, Int8 };
+
+inline uint16_t float_to_half(float f) {
+#ifdef __F16C__
+  return _cvtss_sh(f, 0);
+#else
+  // round to nearest even like F16C; NaN stays a (quiet) NaN
+  uint32_t x = std::bit_cast<uint32_t>(f);
+  uint32_t sign = (x >> 16) & 0x8000;
+  if ((x & 0x7fffffff) > 0x7f800000) return sign | 0x7e00 | (x >> 13 & 0x3ff);
+  int32_t exp = int32_t((x >> 23) & 0xff) - 127 + 15;
+  uint32_t mant = x & 0x7fffff;
+  uint32_t shift = 13;
+  if (exp <= 0) {  // subnormal or zero
+    if (exp < -10) return sign;
+    mant |= 0x800000;
+    shift = 14 - exp;
+    exp = 0;
+  }
+  if (exp >= 31) return sign | 0x7c00;  // overflow to inf
+  uint32_t h = (exp << 10) | (mant >> shift);
+  const uint32_t rest = mant & ((1u << shift) - 1), half = 1u << (shift - 1);
+  h += rest > half || (rest == half && (h & 1));
+  return sign | h;
+#endif
+}
+
+inline float half_to_float(uint16_t h) {
+#ifdef __F16C__
+  return _cvtsh_ss(h);
+#else
+  uint32_t sign = uint32_t(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+  if (exp == 0) {  // subnormal or zero
+    float f = std::ldexp(float(mant), -24);
+    return sign ? -f : f;
+  }
+  if (exp == 31) return std::bit_cast<float>(sign | 0x7f800000 | mant << 13);
+  return std::bit_cast<float>(sign | (exp + 112) << 23 | mant << 13);
+#endif
+}
+
+// Maps a cell value to its coordinate in a tuple index. `DenseIndex` keeps
+// every value 0..99 apart; `BucketIndex` is exact below 16 and merges larger
+// values into buckets of 2, 4 and 8, which shrinks a 3-tuple from 100^3 to
+// 40^3 entries.
+struct DenseIndex {
+  static constexpr int range = 100;
+  static constexpr int map(int v) { return v; }
+};
+
+struct BucketIndex {
+  static constexpr auto table = [] {
+    std::array<uint8_t, 128> t = {};
+    for (int v = 0; v < 128; v++) {
+      t[v] = v < 16 ? v : v < 32 ? 16 + (v - 16) / 2
+                        : v < 64 ? 24 + (v - 32) / 4
+                                 : 32 + (v - 64) / 8;
+    }
+    return t;
+  }();
+  static constexpr int range = table[127] + 1;
+  static constexpr int map(int v) { return table[v]; }
+};
+
+template <int FEAT_SIZE, int FEAT_NUM, class Index = DenseIndex>
 class TupleNet {
  private:
-  static constexpr int NUM_RANGE = 100;
+  static constexpr int NUM_RANGE = Index::range;
   static constexpr size_t net_size =
       static_cast<size_t>(std::pow(NUM_RANGE, FEAT_SIZE));
 
  public:
   TupleNet() {
     for (auto& v : values) {
-      v = new Board::Reward[net_size];
-      std::fill(v, v + net_size, 0);
+      v = std::make_unique<Board::Reward[]>(net_size);
     }
     weights.fill(1.0f);
+    scales.fill(1.0f);
   };
   TupleNet(const std::string& load_path);
   TupleNet(const std::array<std::array<int, FEAT_SIZE>, FEAT_NUM>& feat_idx_)
       : TupleNet() {
-    feat_idx = feat_idx_;
-  };
-  ~TupleNet(){
-      // for (auto& v : values) delete[] v;
+    set_feats(feat_idx_);
   };
-  void load(const std::string& load_path);
+  // false, with the net left as it was, if the file can't be loaded
+  bool load(const std::string& load_path);
+  // false if the constructor's file couldn't be loaded
+  bool is_valid() const { return valid; }
   void save(const std::string& save_path);
   Board::Reward evaluate(const Board& b) const;
   void update_net(const Board& b, const Board::Reward error,
                   const Board::Reward lr);
+  // Equivalent to calling `evaluate` / `update_net` on each board in turn, but
+  // the table reads of several boards are interleaved so their cache misses
+  // overlap.
+  void evaluate_batch(std::span<const Board> boards,
+                      std::span<Board::Reward> out) const;
+  void update_batch(std::span<const Board> boards,
+                    std::span<const Board::Reward> errors,
+                    const Board::Reward lr);
   void update_weights(const Board& b, const Board::Reward error,
                       const Board::Reward lr, const Board::Reward lambda);
-  auto get_feats(const Board& b) const {
-    std::vector<std::pair<int, uint32_t>> result;
+  // Build 16- or 8-bit inference tables from the float master copy.
+  // `update_net` keeps both in sync. Integer scales cover the largest entry
+  // any `calibration` board reads (every entry if empty), so int8 steps
+  // aren't wasted on unvisited outliers; entries beyond it saturate.
+  void quantize(Precision p, std::span<const Board> calibration = {});
+  // free the float master copy of a quantized net for inference-only use;
+  // it can't be updated, saved or quantized again after that
+  void drop_master();
+  size_t table_bytes() const;
+  static constexpr int isom_num = 8;
+  // tuple indices of the 8 symmetric boards, `feats[i * isom_num + isom]`
+  using Feats = std::array<uint32_t, FEAT_NUM * isom_num>;
+  // `evaluate` / `update_net` from indices computed earlier by `get_feats`,
+  // valid while the feature layout is unchanged
+  Board::Reward evaluate_feats(const Feats& feats) const;
+  void update_feats(const Feats& feats, const Board::Reward error,
+                    const Board::Reward lr);
+  Feats get_feats(const Board& b) const {
+    alignas(32) uint32_t cells[9][8];
+    isomorphic_cells(b, cells, Index::map);
+    Feats result;
     for (int i = 0; i < FEAT_NUM; i++) {
-      for (int isom = 0; isom < isom_num; isom++) {
-        uint32_t feat = 0;
-        for (const auto& f : feat_idx[i]) {
-          feat = feat * NUM_RANGE;
-          feat += b.get(f, isom);
+      uint32_t* feat = &result[i * isom_num];
+      for (int isom = 0; isom < isom_num; isom++) feat[isom] = 0;
+      for (const auto& f : feat_idx[i]) {
+        for (int isom = 0; isom < isom_num; isom++) {
+          feat[isom] = feat[isom] * NUM_RANGE + cells[f][isom];
         }
-        result.emplace_back(i, feat);
       }
     }
     return result;
@@ -57,11 +230,59 @@ class TupleNet {
   void set_feats(
       const std::array<std::array<int, FEAT_SIZE>, FEAT_NUM>& feat_idx_) {
     feat_idx = feat_idx_;
+    plan.build(feat_idx);
+  }
+
+  // Tuple indices and their weighted sum, carried down a search so a move
+  // only recomputes the tuples that read its row or column.
+  struct Accumulator {
+    Feats idx;
+    // table entry behind each index, so an update never rereads old entries
+    std::array<Board::Reward, FEAT_NUM * isom_num> part;
+    Board::Reward value;
+  };
+  Accumulator accumulate(const Board& b) const {
+    Accumulator acc;
+    acc.idx = get_feats(b);
+    acc.value = 0;
+    for (int k = 0; k < FEAT_NUM * isom_num; k++) {
+      const int i = k / isom_num;
+      acc.part[k] = entry(i, acc.idx[k]);
+      acc.value += acc.part[k] * weights[i];
+    }
+    return acc;
+  }
+  // `b` is the board after `action` was applied, or after it was undone
+  void update(Accumulator& acc, const Board& b, Board::Action action) const {
+    const auto& touched = plan.touched[action % 6];
+    for (int s = 0; s < isom_num; s++) {
+      for (uint64_t m = touched[s]; m; m &= m - 1) {
+        const int i = std::countr_zero(m);
+        uint32_t feat = 0;
+        for (const auto& c : plan.cells[s][i]) {
+          feat = feat * NUM_RANGE + Index::map(b.get(c));
+        }
+        const int k = i * isom_num + s;
+        if (feat != acc.idx[k]) {
+          const Board::Reward part = entry(i, feat);
+          acc.value += (part - acc.part[k]) * weights[i];
+          acc.idx[k] = feat;
+          acc.part[k] = part;
+        }
+      }
+    }
   }
 
  public:
-  // n tuple value array
-  std::array<Board::Reward*, FEAT_NUM> values;
+  // n tuple value array, float master copy; after `load` it points into the
+  // copy-on-write mapping of the model file
+  std::array<Table<Board::Reward>, FEAT_NUM> values;
+  // 16-bit inference tables, int16 (times `scales`) or fp16 bits
+  std::array<std::unique_ptr<int16_t[]>, FEAT_NUM> qvalues;
+  // int8 inference tables, times `scales`
+  std::array<std::unique_ptr<int8_t[]>, FEAT_NUM> q8values;
+  std::array<Board::Reward, FEAT_NUM> scales;
+  Precision precision = Precision::Float32;
   // feature index array
   std::array<std::array<int, FEAT_SIZE>, FEAT_NUM> feat_idx;
 
@@ -69,80 +290,363 @@ class TupleNet {
 
   std::array<Board::Reward, FEAT_NUM> gradient_weights;
 
-  int isom_num = 8;
+ private:
+  static constexpr size_t batch_chunk = 8;
+  UpdatePlan<FEAT_SIZE, FEAT_NUM> plan;
+  bool valid = true;
+  static ModelHeader header() {
+    return {.feat_size = FEAT_SIZE,
+            .feat_num = FEAT_NUM,
+            .num_range = NUM_RANGE,
+            .table_num = FEAT_NUM,
+            .table_size = net_size};
+  }
+  Board::Reward evaluate_scalar(const Feats& feats) const;
+  void get_feats(const Board& b, Feats& feats) const {
+#ifdef NET_X86
+    if (cpu_has_avx2) return get_feats_avx2(b, feats);
+#endif
+    feats = get_feats(b);
+  }
+  Board::Reward entry(int i, uint32_t feat) const {
+    if (precision == Precision::Int8) return q8values[i][feat] * scales[i];
+    if (precision == Precision::Int16) return qvalues[i][feat] * scales[i];
+    if (precision == Precision::Float16)
+      return half_to_float(std::bit_cast<uint16_t>(qvalues[i][feat]));
+    return values[i][feat];
+  }
+#ifdef NET_X86
+  NET_AVX2 Board::Reward evaluate_avx2(const Board& b) const;
+  // `feats` must be 32-byte aligned
+  NET_AVX2 void get_feats_avx2(const Board& b, Feats& feats) const;
+  NET_AVX2 Board::Reward evaluate_feats_avx2(const Feats& feats) const;
+  NET_AVX2 __m256 gather(int i, const uint32_t* feat) const;
+  NET_AVX2 void evaluate_chunk_avx2(const Feats* feats, size_t n,
+                                    Board::Reward* out) const;
+#endif
+  int16_t encode(int i, Board::Reward v) const {
+    if (precision == Precision::Float16)
+      return std::bit_cast<int16_t>(float_to_half(v));
+    const float max = precision == Precision::Int8 ? 127.0f : 32767.0f;
+    return int16_t(std::clamp(std::round(v / scales[i]), -max, max));
+  }
+  // requantize entry `feat` of feature `i`, whose float value is now `v`
+  void sync(int i, uint32_t feat, Board::Reward v) {
+    if (precision == Precision::Int8) {
+      store_relaxed(q8values[i][feat], int8_t(encode(i, v)));
+    } else if (precision != Precision::Float32) {
+      store_relaxed(qvalues[i][feat], encode(i, v));
+    }
+  }
 };
 
-template <int FEAT_SIZE, int FEAT_NUM>
-TupleNet<FEAT_SIZE, FEAT_NUM>::TupleNet(const std::string& load_path)
-    : TupleNet() {
-  load(load_path);
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+TupleNet<FEAT_SIZE, FEAT_NUM, Index>::TupleNet(const std::string& load_path) {
+  // no zeroed tables up front, `load` maps them from the file
+  weights.fill(1.0f);
+  scales.fill(1.0f);
+  valid = load(load_path);
+  for (auto& v : values) {
+    if (!v) v = std::make_unique<Board::Reward[]>(net_size);
+  }
 };
 
-template <int FEAT_SIZE, int FEAT_NUM>
-void TupleNet<FEAT_SIZE, FEAT_NUM>::save(const std::string& save_path) {
-  std::ofstream ofs(save_path,
-                    std::ios::out | std::ios::binary | std::ios::trunc);
-  if (!ofs.is_open()) {
-    std::cout << "Cannot open file " << save_path << std::endl;
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+void TupleNet<FEAT_SIZE, FEAT_NUM, Index>::save(const std::string& save_path) {
+  if (!values[0]) {
+    std::cout << "Cannot save " << save_path << " without float master copy"
+              << std::endl;
     return;
   }
-  for (auto& v : feat_idx) {
-    ofs.write(reinterpret_cast<char*>(v.data()), sizeof(int) * FEAT_SIZE);
-  }
-  for (auto& v : values) {
-    ofs.write(reinterpret_cast<char*>(v), sizeof(Board::Reward) * net_size);
-  }
+  std::array<const Board::Reward*, FEAT_NUM> tables;
+  for (int i = 0; i < FEAT_NUM; i++) tables[i] = values[i].get();
+  write_model(save_path, header(), {feat_idx[0].data(), FEAT_SIZE * FEAT_NUM},
+              tables);
+};
 
-  ofs.close();
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+bool TupleNet<FEAT_SIZE, FEAT_NUM, Index>::load(const std::string& load_path) {
+  // the tables are used in place; pages are shared with other processes
+  // that load the same file until an update writes to them
+  ModelFile file(load_path, header());
+  if (!file.is_valid()) return false;
+  std::copy_n(file.layout(), FEAT_SIZE * FEAT_NUM, feat_idx[0].data());
+  plan.build(feat_idx);
+  for (int i = 0; i < FEAT_NUM; i++) values[i] = file.share(i);
+  if (precision != Precision::Float32) quantize(precision);
+  return valid = true;
 };
 
-template <int FEAT_SIZE, int FEAT_NUM>
-void TupleNet<FEAT_SIZE, FEAT_NUM>::load(const std::string& load_path) {
-  std::ifstream ifs(load_path);
-  if (!ifs.is_open()) {
-    std::cout << "Cannot open file " << load_path << std::endl;
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+void TupleNet<FEAT_SIZE, FEAT_NUM, Index>::quantize(
+    Precision p, std::span<const Board> calibration) {
+  if (!values[0]) {
+    std::cout << "Cannot quantize without float master copy" << std::endl;
     return;
   }
-  for (auto& v : feat_idx) {
-    ifs.read(reinterpret_cast<char*>(v.data()), sizeof(int) * FEAT_SIZE);
+  precision = p;
+  for (auto& q : qvalues) q.reset();
+  for (auto& q : q8values) q.reset();
+  if (p == Precision::Float32) return;
+  std::array<Board::Reward, FEAT_NUM> max_abs = {};
+  if (calibration.empty()) {
+    for (int i = 0; i < FEAT_NUM; i++) {
+      for (size_t j = 0; j < net_size; j++) {
+        max_abs[i] = std::max(max_abs[i], std::abs(values[i][j]));
+      }
+    }
+  } else {
+    for (const auto& b : calibration) {
+      const auto feats = get_feats(b);
+      for (int k = 0; k < FEAT_NUM * isom_num; k++) {
+        const int i = k / isom_num;
+        max_abs[i] = std::max(max_abs[i], std::abs(values[i][feats[k]]));
+      }
+    }
   }
-  for (auto& v : values) {
-    v = new Board::Reward[net_size];
-    ifs.read(reinterpret_cast<char*>(v), sizeof(Board::Reward) * net_size);
+  for (int i = 0; i < FEAT_NUM; i++) {
+    const Board::Reward* v = values[i].get();
+    const float max = p == Precision::Int8 ? 127.0f : 32767.0f;
+    scales[i] = (p != Precision::Float16 && max_abs[i] > 0) ? max_abs[i] / max
+                                                            : 1;
+    // spare entries so a 32-bit gather of the last entry stays in bounds
+    if (p == Precision::Int8) {
+      q8values[i] = std::make_unique<int8_t[]>(net_size + 3);
+      for (size_t j = 0; j < net_size; j++) q8values[i][j] = encode(i, v[j]);
+    } else {
+      qvalues[i] = std::make_unique<int16_t[]>(net_size + 1);
+      for (size_t j = 0; j < net_size; j++) qvalues[i][j] = encode(i, v[j]);
+    }
+  }
+};
+
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+void TupleNet<FEAT_SIZE, FEAT_NUM, Index>::drop_master() {
+  if (precision == Precision::Float32) {
+    std::cout << "Cannot drop the float master copy of a float net"
+              << std::endl;
+    return;
+  }
+  for (auto& v : values) v.reset();
+};
+
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+size_t TupleNet<FEAT_SIZE, FEAT_NUM, Index>::table_bytes() const {
+  size_t bytes = 0;
+  for (int i = 0; i < FEAT_NUM; i++) {
+    if (values[i]) bytes += net_size * sizeof(Board::Reward);
+    if (qvalues[i]) bytes += (net_size + 1) * sizeof(int16_t);
+    if (q8values[i]) bytes += net_size + 3;
   }
-  ifs.close();
+  return bytes;
 };
 
 // evaluate the board
-template <int FEAT_SIZE, int FEAT_NUM>
-Board::Reward TupleNet<FEAT_SIZE, FEAT_NUM>::evaluate(const Board& b) const {
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+Board::Reward TupleNet<FEAT_SIZE, FEAT_NUM, Index>::evaluate(
+    const Board& b) const {
+#ifdef NET_X86
+  if (cpu_has_avx2) return evaluate_avx2(b);
+#endif
+  return evaluate_scalar(get_feats(b));
+};
+
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+Board::Reward TupleNet<FEAT_SIZE, FEAT_NUM, Index>::evaluate_feats(
+    const Feats& feats) const {
+#ifdef NET_X86
+  if (cpu_has_avx2) return evaluate_feats_avx2(feats);
+#endif
+  return evaluate_scalar(feats);
+};
+
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+Board::Reward TupleNet<FEAT_SIZE, FEAT_NUM, Index>::evaluate_scalar(
+    const Feats& feats) const {
   Board::Reward value = 0;
-  for (const auto& [i, feat] : get_feats(b)) {
-    value += values[i][feat] * weights[i];
+  for (int i = 0; i < FEAT_NUM; i++) {
+    const uint32_t* feat = &feats[i * isom_num];
+    Board::Reward sum = 0;
+    if (precision == Precision::Int8) {
+      int32_t q = 0;
+      for (int isom = 0; isom < isom_num; isom++) q += q8values[i][feat[isom]];
+      sum = q * scales[i];
+    } else if (precision == Precision::Int16) {
+      int32_t q = 0;
+      for (int isom = 0; isom < isom_num; isom++) q += qvalues[i][feat[isom]];
+      sum = q * scales[i];
+    } else if (precision == Precision::Float16) {
+      for (int isom = 0; isom < isom_num; isom++)
+        sum += half_to_float(qvalues[i][feat[isom]]);
+    } else {
+      for (int isom = 0; isom < isom_num; isom++) sum += values[i][feat[isom]];
+    }
+    value += sum * weights[i];
   }
   return value;
 };
 
+#ifdef NET_X86
+// indices are computed 8 symmetries at a time and the table reads are gathers
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+NET_AVX2 Board::Reward TupleNet<FEAT_SIZE, FEAT_NUM, Index>::evaluate_avx2(
+    const Board& b) const {
+  alignas(32) Feats feats;
+  get_feats_avx2(b, feats);
+  return evaluate_feats_avx2(feats);
+};
+
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+NET_AVX2 void TupleNet<FEAT_SIZE, FEAT_NUM, Index>::get_feats_avx2(
+    const Board& b, Feats& feats) const {
+  alignas(32) uint32_t cells[9][8];
+  isomorphic_cells(b, cells, Index::map);
+  const __m256i range = _mm256_set1_epi32(NUM_RANGE);
+  for (int i = 0; i < FEAT_NUM; i++) {
+    __m256i idx = _mm256_setzero_si256();
+    for (const auto& f : feat_idx[i]) {
+      idx = _mm256_add_epi32(
+          _mm256_mullo_epi32(idx, range),
+          _mm256_load_si256(reinterpret_cast<const __m256i*>(cells[f])));
+    }
+    _mm256_store_si256(reinterpret_cast<__m256i*>(&feats[i * isom_num]), idx);
+  }
+};
+
+// table entries `idx` of feature `i` as floats, unweighted
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+NET_AVX2 __m256 TupleNet<FEAT_SIZE, FEAT_NUM, Index>::gather(
+    int i, const uint32_t* feat) const {
+  const __m256i idx =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(feat));
+  if (precision == Precision::Float32) {
+    return _mm256_i32gather_ps(values[i].get(), idx, 4);
+  }
+  if (precision == Precision::Int8) {
+    // 32-bit gathers at 1-byte stride, the entry is the low byte
+    __m256i q = _mm256_i32gather_epi32(
+        reinterpret_cast<const int*>(q8values[i].get()), idx, 1);
+    q = _mm256_srai_epi32(_mm256_slli_epi32(q, 24), 24);
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(q), _mm256_set1_ps(scales[i]));
+  }
+  // 32-bit gathers at 2-byte stride, the entry is in the low half
+  __m256i q = _mm256_i32gather_epi32(
+      reinterpret_cast<const int*>(qvalues[i].get()), idx, 2);
+  if (precision == Precision::Int16) {
+    q = _mm256_srai_epi32(_mm256_slli_epi32(q, 16), 16);
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(q), _mm256_set1_ps(scales[i]));
+  }
+  q = _mm256_and_si256(q, _mm256_set1_epi32(0xffff));
+  return _mm256_cvtph_ps(_mm_packus_epi32(_mm256_castsi256_si128(q),
+                                          _mm256_extracti128_si256(q, 1)));
+};
+
+// the 8 symmetries are summed in-register, so sum the lanes once at the end
+NET_AVX2 inline Board::Reward hsum_avx2(__m256 acc) {
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+                          _mm256_extractf128_ps(acc, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+  return _mm_cvtss_f32(sum);
+}
+
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+NET_AVX2 Board::Reward TupleNet<FEAT_SIZE, FEAT_NUM, Index>::evaluate_feats_avx2(
+    const Feats& feats) const {
+  __m256 acc = _mm256_setzero_ps();
+  for (int i = 0; i < FEAT_NUM; i++) {
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(gather(i, &feats[i * isom_num]),
+                                           _mm256_set1_ps(weights[i])));
+  }
+  return hsum_avx2(acc);
+};
+
+// Feature-major over the chunk: the gathers of one feature for all boards are
+// independent of each other, so their misses overlap instead of each board's
+// dependent accumulation chain waiting on its own loads.
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+NET_AVX2 void TupleNet<FEAT_SIZE, FEAT_NUM, Index>::evaluate_chunk_avx2(
+    const Feats* feats, size_t n, Board::Reward* out) const {
+  __m256 acc[batch_chunk];
+  for (size_t j = 0; j < n; j++) acc[j] = _mm256_setzero_ps();
+  for (int i = 0; i < FEAT_NUM; i++) {
+    const __m256 w = _mm256_set1_ps(weights[i]);
+    for (size_t j = 0; j < n; j++) {
+      acc[j] = _mm256_add_ps(
+          acc[j], _mm256_mul_ps(gather(i, &feats[j][i * isom_num]), w));
+    }
+  }
+  for (size_t j = 0; j < n; j++) out[j] = hsum_avx2(acc[j]);
+};
+#endif
+
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+void TupleNet<FEAT_SIZE, FEAT_NUM, Index>::evaluate_batch(
+    std::span<const Board> boards, std::span<Board::Reward> out) const {
+  alignas(32) std::array<Feats, batch_chunk> feats;
+  for (size_t first = 0; first < boards.size(); first += batch_chunk) {
+    const size_t n = std::min(batch_chunk, boards.size() - first);
+    for (size_t j = 0; j < n; j++) get_feats(boards[first + j], feats[j]);
+#ifdef NET_X86
+    if (cpu_has_avx2) {
+      evaluate_chunk_avx2(feats.data(), n, &out[first]);
+      continue;
+    }
+#endif
+    for (size_t j = 0; j < n; j++) out[first + j] = evaluate_scalar(feats[j]);
+  }
+};
+
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+void TupleNet<FEAT_SIZE, FEAT_NUM, Index>::update_batch(
+    std::span<const Board> boards, std::span<const Board::Reward> errors,
+    const Board::Reward lr) {
+  assert(values[0] && "float master copy dropped by drop_master");
+  alignas(32) std::array<Feats, batch_chunk> feats;
+  for (size_t first = 0; first < boards.size(); first += batch_chunk) {
+    const size_t n = std::min(batch_chunk, boards.size() - first);
+    for (size_t j = 0; j < n; j++) get_feats(boards[first + j], feats[j]);
+    for (size_t j = 0; j < n; j++) {
+      const Board::Reward delta =
+          lr * errors[first + j] / (FEAT_NUM * isom_num);
+      for (int k = 0; k < FEAT_NUM * isom_num; k++) {
+        const int i = k / isom_num;
+        sync(i, feats[j][k], add_relaxed(values[i][feats[j][k]], delta));
+      }
+    }
+  }
+};
+
 // update the n tuple
-template <int FEAT_SIZE, int FEAT_NUM>
-void TupleNet<FEAT_SIZE, FEAT_NUM>::update_net(const Board& b,
-                                               const Board::Reward error,
-                                               const Board::Reward lr) {
-  for (const auto& [i, feat] : get_feats(b)) {
-    values[i][feat] += lr * error / (FEAT_NUM * isom_num);
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+void TupleNet<FEAT_SIZE, FEAT_NUM, Index>::update_net(
+    const Board& b, const Board::Reward error, const Board::Reward lr) {
+  update_feats(get_feats(b), error, lr);
+};
+
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+void TupleNet<FEAT_SIZE, FEAT_NUM, Index>::update_feats(
+    const Feats& feats, const Board::Reward error, const Board::Reward lr) {
+  assert(values[0] && "float master copy dropped by drop_master");
+  for (int k = 0; k < FEAT_NUM * isom_num; k++) {
+    const int i = k / isom_num;
+    const Board::Reward delta = lr * error / (FEAT_NUM * isom_num);
+    sync(i, feats[k], add_relaxed(values[i][feats[k]], delta));
   }
 };
 
 // update the n tuple
-template <int FEAT_SIZE, int FEAT_NUM>
-void TupleNet<FEAT_SIZE, FEAT_NUM>::update_weights(const Board& b,
-                                                   const Board::Reward error,
-                                                   const Board::Reward lr,
-                                                   const Board::Reward lambda) {
+template <int FEAT_SIZE, int FEAT_NUM, class Index>
+void TupleNet<FEAT_SIZE, FEAT_NUM, Index>::update_weights(
+    const Board& b, const Board::Reward error, const Board::Reward lr,
+    const Board::Reward lambda) {
+  assert(values[0] && "float master copy dropped by drop_master");
   gradient_weights.fill(0.0f);
-  for (const auto& [i, feat] : get_feats(b)) {
-    gradient_weights[i] +=
-        2 * (-error) * values[i][feat] + (2 * lambda * weights[i]) / (isom_num);
+  const auto feats = get_feats(b);
+  for (int k = 0; k < FEAT_NUM * isom_num; k++) {
+    const int i = k / isom_num;
+    gradient_weights[i] += 2 * (-error) * values[i][feats[k]] +
+                           (2 * lambda * weights[i]) / (isom_num);
   }
   for (int i = 0; i < FEAT_NUM; i++) {
     weights[i] -= lr * gradient_weights[i];
@@ -154,75 +658,255 @@ class NewNet {
  public:
   // NewNet(const std::string& load_path);
   NewNet(const std::array<std::array<int, FEAT_SIZE>, FEAT_NUM>& feat_idx_)
-      : feat_idx(feat_idx_) {values.fill(0.0f);};
+      : feat_idx(feat_idx_) {
+    values.fill(0.0f);
+    plan.build(feat_idx);
+  };
   // void load(const std::string& load_path);
   // void save(const std::string& save_path);
-  auto get_feats(const Board& b) const {
-    std::vector<uint32_t> result;
-    for (int isom = 0; isom < 8; isom++) {
-      uint32_t idx = 0;
-      for (const auto& feats : feat_idx) {
-        idx *= 3;
+  // one table index per symmetric board
+  using Feats = std::array<uint32_t, 8>;
+  Feats get_feats(const Board& b) const {
+    alignas(32) uint32_t cells[9][8];
+    isomorphic_cells(b, cells, [](int v) { return v; });
+    Feats result = {};
+    for (const auto& feats : feat_idx) {
+      for (int isom = 0; isom < 8; isom++) {
         uint32_t feat = 0;
         for (const auto& f : feats) {
-          feat ^= b.get(f, isom);
+          feat ^= cells[f][isom];
         }
-        feat %= 3;
-        idx += feat;
+        result[isom] = result[isom] * 3 + feat % 3;
       }
-      result.emplace_back(idx);
     }
     return result;
   }
   Board::Reward evaluate(const Board& b) const {
+#ifdef NET_X86
+    if (cpu_has_avx2) return evaluate_avx2(b);
+#endif
+    return evaluate_feats(get_feats(b));
+  };
+  // `evaluate` / `update_net` from indices computed earlier by `get_feats`
+  Board::Reward evaluate_feats(const Feats& feats) const {
     Board::Reward value = 0;
-    for (const auto& feat : get_feats(b)) {
-      value += values[feat];
+    for (const auto& feat : feats) {
+      value += entry(feat);
     }
     return value;
-  };
+  }
+  void update_feats(const Feats& feats, const Board::Reward error,
+                    const Board::Reward lr) {
+    for (const auto& feat : feats) {
+      const Board::Reward v = add_relaxed(values[feat], lr * error / 8);
+      if (precision == Precision::Int8) {
+        store_relaxed(q8values[feat], encode(v));
+      }
+    }
+  }
+#ifdef NET_X86
+  NET_AVX2 Board::Reward evaluate_avx2(const Board& b) const {
+    alignas(32) uint32_t cells[9][8];
+    isomorphic_cells(b, cells, [](int v) { return v; });
+    const __m256i three = _mm256_set1_epi32(3);
+    __m256i idx = _mm256_setzero_si256();
+    for (const auto& feats : feat_idx) {
+      __m256i feat = _mm256_setzero_si256();
+      for (const auto& f : feats) {
+        feat = _mm256_xor_si256(
+            feat,
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(cells[f])));
+      }
+      // feat % 3 as feat - 3 * (feat * 0xaaab >> 17), exact for feat < 2^15
+      __m256i q = _mm256_srli_epi32(
+          _mm256_mullo_epi32(feat, _mm256_set1_epi32(0xaaab)), 17);
+      feat = _mm256_sub_epi32(feat, _mm256_mullo_epi32(q, three));
+      idx = _mm256_add_epi32(_mm256_mullo_epi32(idx, three), feat);
+    }
+    __m256 v;
+    if (precision == Precision::Int8) {
+      __m256i q = _mm256_i32gather_epi32(
+          reinterpret_cast<const int*>(q8values.data()), idx, 1);
+      q = _mm256_srai_epi32(_mm256_slli_epi32(q, 24), 24);
+      v = _mm256_mul_ps(_mm256_cvtepi32_ps(q), _mm256_set1_ps(scale));
+    } else {
+      v = _mm256_i32gather_ps(values.data(), idx, 4);
+    }
+    __m128 sum =
+        _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+  }
+#endif
 
   void update_net(const Board& b, const Board::Reward error,
                   const Board::Reward lr){
-    for (const auto& feat : get_feats(b)) {
-      values[feat] += lr * error / (8);
-    }
+    update_feats(get_feats(b), error, lr);
   };
+  // Float32, or Int8 with one scale for the whole table; the float values
+  // stay the master copy and `update_net` keeps both in sync. The scale
+  // covers the largest entry any `calibration` board reads (every entry if
+  // empty).
+  void quantize(Precision p, std::span<const Board> calibration = {}) {
+    precision = p == Precision::Int8 ? p : Precision::Float32;
+    if (precision == Precision::Float32) return;
+    Board::Reward max_abs = 0;
+    if (calibration.empty()) {
+      for (const auto& v : values) max_abs = std::max(max_abs, std::abs(v));
+    } else {
+      for (const auto& b : calibration) {
+        for (const auto& feat : get_feats(b)) {
+          max_abs = std::max(max_abs, std::abs(values[feat]));
+        }
+      }
+    }
+    scale = max_abs > 0 ? max_abs / 127 : 1;
+    for (size_t j = 0; j < values.size(); j++) q8values[j] = encode(values[j]);
+  }
+  // the whole table is ~26 KB and stays in L1, so nothing to interleave
+  void evaluate_batch(std::span<const Board> boards,
+                      std::span<Board::Reward> out) const {
+    for (size_t j = 0; j < boards.size(); j++) out[j] = evaluate(boards[j]);
+  }
+  void update_batch(std::span<const Board> boards,
+                    std::span<const Board::Reward> errors,
+                    const Board::Reward lr) {
+    for (size_t j = 0; j < boards.size(); j++) {
+      update_net(boards[j], errors[j], lr);
+    }
+  }
   
   void set_feats(const std::array<std::array<int, FEAT_SIZE>, FEAT_NUM>& feat_idx_) {
     feat_idx = feat_idx_;
+    plan.build(feat_idx);
   }
-  void load(const std::string& load_path) {
-    std::ifstream ifs(load_path);
-    if (!ifs.is_open()) {
-      std::cout << "Cannot open file " << load_path << std::endl;
-      return;
+
+  // Per-symmetry feature digits, table indices and their summed value,
+  // carried down a search so a move only recomputes the features that read
+  // its row or column.
+  struct Accumulator {
+    std::array<std::array<uint8_t, FEAT_NUM>, 8> digits;
+    std::array<uint32_t, 8> idx;
+    Board::Reward value;
+  };
+  Accumulator accumulate(const Board& b) const {
+    Accumulator acc;
+    acc.value = 0;
+    for (int s = 0; s < 8; s++) {
+      acc.idx[s] = 0;
+      for (int k = 0; k < FEAT_NUM; k++) {
+        acc.digits[s][k] = digit(b, s, k);
+        acc.idx[s] = acc.idx[s] * 3 + acc.digits[s][k];
+      }
+      acc.value += entry(acc.idx[s]);
     }
-    for (auto& v : feat_idx) {
-      ifs.read(reinterpret_cast<char*>(v.data()), sizeof(int) * FEAT_SIZE);
+    return acc;
+  }
+  // `b` is the board after `action` was applied, or after it was undone
+  void update(Accumulator& acc, const Board& b, Board::Action action) const {
+    static constexpr auto pow3 = [] {
+      std::array<int32_t, FEAT_NUM> p = {};
+      int32_t v = 1;
+      for (int k = FEAT_NUM - 1; k >= 0; k--, v *= 3) p[k] = v;
+      return p;
+    }();
+    const auto& touched = plan.touched[action % 6];
+    for (int s = 0; s < 8; s++) {
+      int32_t delta = 0;
+      for (uint64_t m = touched[s]; m; m &= m - 1) {
+        const int k = std::countr_zero(m);
+        const uint8_t d = digit(b, s, k);
+        delta += (d - acc.digits[s][k]) * pow3[k];
+        acc.digits[s][k] = d;
+      }
+      if (delta) {
+        const uint32_t idx = acc.idx[s] + delta;
+        acc.value += entry(idx) - entry(acc.idx[s]);
+        acc.idx[s] = idx;
+      }
     }
-    ifs.read(reinterpret_cast<char*>(values.data()), sizeof(Board::Reward) * values.size());
-    ifs.close();
+  }
+  // the 26 KB table is copied out of the mapping, it's read on every
+  // evaluation and the copy keeps the net a plain value type
+  bool load(const std::string& load_path) {
+    ModelFile file(load_path, header());
+    if (!file.is_valid()) return false;
+    std::copy_n(file.layout(), FEAT_SIZE * FEAT_NUM, feat_idx[0].data());
+    plan.build(feat_idx);
+    std::copy_n(file.table(0), values.size(), values.data());
+    if (precision != Precision::Float32) quantize(precision);
+    return valid = true;
   };
-  void save(const std::string& save_path) {
-    std::ofstream ofs(save_path,
-                      std::ios::out | std::ios::binary | std::ios::trunc);
-    if (!ofs.is_open()) {
-      std::cout << "Cannot open file " << save_path << std::endl;
-      return;
-    }
-    for (auto& v : feat_idx) {
-      ofs.write(reinterpret_cast<char*>(v.data()), sizeof(int) * FEAT_SIZE);
-    }
-    ofs.write(reinterpret_cast<char*>(values.data()), sizeof(Board::Reward) * values.size());
-    ofs.close();
+  bool is_valid() const { return valid; }
+  void save(const std::string& save_path) const {
+    const Board::Reward* table = values.data();
+    write_model(save_path, header(), {feat_idx[0].data(), FEAT_SIZE * FEAT_NUM},
+                {&table, 1});
   };
+  // a zero net if the file can't be loaded
   NewNet(const std::string &load_path) {
-    load(load_path);
+    values.fill(0.0f);
+    valid = load(load_path);
   }
  public:
   // n tuple value array
   std::array<Board::Reward, static_cast<int>(std::pow(FEAT_SIZE, FEAT_NUM))> values;
+  // int8 inference table, times `scale`; 3 spare bytes for 32-bit gathers
+  std::array<int8_t, static_cast<int>(std::pow(FEAT_SIZE, FEAT_NUM)) + 3>
+      q8values = {};
+  Board::Reward scale = 1;
+  Precision precision = Precision::Float32;
   // feature index array
   std::array<std::array<int, FEAT_SIZE>, FEAT_NUM> feat_idx;
-};
\ No newline at end of file
+
+ private:
+  UpdatePlan<FEAT_SIZE, FEAT_NUM> plan;
+  bool valid = true;
+  static ModelHeader header() {
+    return {.feat_size = FEAT_SIZE,
+            .feat_num = FEAT_NUM,
+            .num_range = 3,
+            .table_num = 1,
+            .table_size = std::tuple_size_v<decltype(values)>};
+  }
+  Board::Reward entry(uint32_t feat) const {
+    return precision == Precision::Int8 ? q8values[feat] * scale
+                                        : values[feat];
+  }
+  int8_t encode(Board::Reward v) const {
+    return int8_t(std::clamp(std::round(v / scale), -127.0f, 127.0f));
+  }
+  uint8_t digit(const Board& b, int s, int k) const {
+    uint32_t feat = 0;
+    for (const auto& c : plan.cells[s][k]) feat ^= b.get(c);
+    return feat % 3;
+  }
+};
+
+// Queues leaf boards and evaluates them with `Net::evaluate_batch`, writing
+// each result through the pointer given to `push`. Results are only valid
+// after `flush`, which also runs whenever the queue fills up.
+template <class Net, size_t N = 64>
+class EvalQueue {
+ public:
+  EvalQueue(const Net& net) : net(net){};
+  ~EvalQueue() { flush(); }
+  void push(const Board& b, Board::Reward* out) {
+    boards[size] = b;
+    outs[size] = out;
+    if (++size == N) flush();
+  }
+  void flush() {
+    net.evaluate_batch({boards.data(), size}, {values.data(), size});
+    for (size_t j = 0; j < size; j++) *outs[j] = values[j];
+    size = 0;
+  }
+
+ private:
+  const Net& net;
+  size_t size = 0;
+  std::array<Board, N> boards;
+  std::array<Board::Reward*, N> outs;
+  std::array<Board::Reward, N> values;
+};
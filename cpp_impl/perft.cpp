@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "board.hpp"
+#include "episode.hpp"
+
+// Enumerates the game tree from the given boards to depth 1..N and counts
+// what it finds, as a move generation benchmark and as reference numbers
+// for any rewrite of `Board`: the counts must not change.
+//
+// At each depth: `moves` is every move applied, `leaves` the positions still
+// running after exactly `depth` moves, `bonus` and `penalty` the games that
+// ended within `depth` moves either way. Moves are generated in action order
+// with `Board::legal`.
+//
+// With `hash=BITS` subtree counts are cached in a 2^BITS entry table keyed
+// by canonical `Board::hash()` and remaining depth, so transpositions and
+// symmetric positions are counted once; entries hold the full key, so the
+// counts stay exact. The root moves are split across `threads`, each with
+// its own table, kept across depths and boards; the moves/sec figure then
+// counts the moves the table stood in for, not moves applied.
+//
+// options: depth=N, board=RAW or board=C0,C1,...,C8 (repeatable), random=K
+// (K random boards from seed=S), threads=N, hash=BITS, divide (counts per
+// root move), check (count the reference boards below instead and exit 1 if
+// any count differs)
+struct Counts {
+  uint64_t moves = 0;
+  uint64_t leaves = 0;
+  uint64_t bonus = 0;
+  uint64_t penalty = 0;
+  Counts& operator+=(const Counts& c) {
+    moves += c.moves;
+    leaves += c.leaves;
+    bonus += c.bonus;
+    penalty += c.penalty;
+    return *this;
+  }
+  bool operator==(const Counts&) const = default;
+};
+
+struct Reference {
+  std::array<int, 9> cells;
+  int depth;
+  Counts counts;
+};
+const Reference references[] = {
+    {{3, 4, 3, 5, 3, 3, 2, 4, 3}, 8, {179180, 0, 96504, 3204}},
+    {{20, 20, 20, 20, 20, 20, 20, 20, 20}, 6, {36012942, 34012224, 0, 0}},
+};
+
+class PerftTable {
+ public:
+  PerftTable(int bits) : shift(64 - bits), table(size_t(1) << bits) {}
+  bool probe(Board::Hash key, int depth, Counts& c) {
+    const Entry& e = table[index(key, depth)];
+    if (e.depth != depth || e.key != key) return false;
+    hits++;
+    c = e.counts;
+    return true;
+  }
+  void store(Board::Hash key, int depth, const Counts& c) {
+    table[index(key, depth)] = {key, depth, c};
+  }
+  uint64_t hits = 0;
+
+ private:
+  struct Entry {
+    Board::Hash key = 0;
+    int depth = -1;
+    Counts counts;
+  };
+  int shift;
+  std::vector<Entry> table;
+  size_t index(Board::Hash key, int depth) const {
+    return (key + depth) * 0x9e3779b97f4a7c15ull >> shift;
+  }
+};
+
+Counts perft(const Board& b, int depth, PerftTable* table) {
+  Counts c;
+  if (depth == 0) {
+    c.leaves = 1;
+    return c;
+  }
+  Board::Hash key = 0;
+  if (table) {
+    key = b.hash();
+    if (table->probe(key, depth, c)) return c;
+  }
+  for (Board::Action action = 0; action < 18; action++) {
+    if (!b.legal(action)) continue;
+    Board next = b;
+    auto&& [reward, done] = next.apply(action);
+    c.moves++;
+    if (done) {
+      // `apply` returns the terminal reward minus the amount subtracted
+      if (reward + (action / 6 + 1) > 0) {
+        c.bonus++;
+      } else {
+        c.penalty++;
+      }
+    } else {
+      c += perft(next, depth - 1, table);
+    }
+  }
+  if (table) table->store(key, depth, c);
+  return c;
+}
+
+std::ostream& operator<<(std::ostream& os, const Counts& c) {
+  return os << "moves " << c.moves << " | leaves " << c.leaves << " | bonus "
+            << c.bonus << " | penalty " << c.penalty;
+}
+
+int main(int argc, const char* argv[]) {
+  int max_depth = 5;
+  std::vector<Board> boards;
+  int random = 0;
+  uint64_t seed = 2048;
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+  int hash_bits = 0;
+  bool divide = false;
+  bool check = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto match_arg = [&](std::string flag) -> bool {
+      auto it = arg.find_first_not_of('-');
+      return arg.find(flag, it) == it;
+    };
+    auto next_opt = [&]() -> std::string {
+      auto it = arg.find('=') + 1;
+      return it ? arg.substr(it) : argv[++i];
+    };
+    if (match_arg("depth")) {
+      max_depth = std::stoi(next_opt());
+    } else if (match_arg("board")) {
+      const std::string value = next_opt();
+      if (value.find(',') == std::string::npos) {
+        boards.push_back(Board(std::stoull(value)));
+      } else {
+        Board b;
+        std::stringstream ss(value);
+        std::string cell;
+        for (int c = 0; c < 9 && std::getline(ss, cell, ','); c++) {
+          b.set(c, std::stoi(cell));
+        }
+        boards.push_back(b);
+      }
+    } else if (match_arg("random")) {
+      random = std::stoi(next_opt());
+    } else if (match_arg("seed")) {
+      seed = std::stoull(next_opt());
+    } else if (match_arg("threads")) {
+      threads = std::max(1, std::stoi(next_opt()));
+    } else if (match_arg("hash")) {
+      hash_bits = std::clamp(std::stoi(next_opt()), 0, 32);
+    } else if (match_arg("divide")) {
+      divide = true;
+    } else if (match_arg("check")) {
+      check = true;
+    }
+  }
+  Board::seed_rng(seed);
+  for (int i = 0; i < random; i++) boards.push_back(RandomBoard());
+  if (check) {
+    boards.clear();
+    for (const auto& r : references) {
+      Board b;
+      for (int c = 0; c < 9; c++) b.set(c, r.cells[c]);
+      boards.push_back(b);
+    }
+  }
+  if (boards.empty()) boards.push_back(RandomBoard());
+
+  // allocated once; entries hold the depth, so they stay valid across runs
+  std::vector<std::unique_ptr<PerftTable>> tables(threads);
+  if (hash_bits) {
+    for (auto& table : tables) table = std::make_unique<PerftTable>(hash_bits);
+  }
+  std::cout.precision(4);
+  int mismatches = 0;
+  for (size_t r = 0; r < boards.size(); r++) {
+    const Board& root = boards[r];
+    const int last = check ? references[r].depth : max_depth;
+    std::cout << "board " << root.hash() << " (canonical)\n" << root;
+    std::vector<Board::Action> actions;
+    for (Board::Action a = 0; a < 18; a++) {
+      if (root.legal(a)) actions.push_back(a);
+    }
+    for (int depth = 1; depth <= last; depth++) {
+      std::vector<Counts> per_move(actions.size());
+      std::atomic<size_t> next = 0;
+      std::atomic<uint64_t> hits = 0;
+      auto worker = [&](int tid) {
+        PerftTable* table = tables[tid].get();
+        if (table) table->hits = 0;
+        for (size_t j; (j = next.fetch_add(1)) < actions.size();) {
+          Board b = root;
+          auto&& [reward, done] = b.apply(actions[j]);
+          Counts& c = per_move[j];
+          c.moves = 1;
+          if (done) {
+            (reward + (actions[j] / 6 + 1) > 0 ? c.bonus : c.penalty) = 1;
+          } else {
+            c += perft(b, depth - 1, table);
+          }
+        }
+        if (table) hits += table->hits;
+      };
+      const auto start = std::chrono::steady_clock::now();
+      std::vector<std::thread> pool;
+      for (int tid = 1; tid < threads; tid++) pool.emplace_back(worker, tid);
+      worker(0);
+      for (auto& t : pool) t.join();
+      const double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+      Counts total;
+      for (const auto& c : per_move) total += c;
+      std::cout << "depth " << depth << ": " << total << " | " << seconds
+                << " sec, " << total.moves / seconds / 1e6 << " M moves/sec";
+      if (hash_bits) std::cout << " | hash hits " << hits.load();
+      std::cout << std::endl;
+      if (check && depth == last && total != references[r].counts) {
+        std::cout << "mismatch, expected " << references[r].counts << std::endl;
+        mismatches++;
+      }
+      if (divide && depth == last) {
+        for (size_t j = 0; j < actions.size(); j++) {
+          std::cout << "  " << actions[j] << ": " << per_move[j] << std::endl;
+        }
+      }
+    }
+  }
+  if (check) {
+    std::cout << (mismatches ? "check failed" : "check passed") << std::endl;
+  }
+  return mismatches ? 1 : 0;
+}
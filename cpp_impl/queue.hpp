@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded multi-producer multi-consumer queue without locks (Vyukov's
+// array queue). Each cell carries a sequence number telling producers and
+// consumers whose turn it is, so a push or pop is one CAS on the shared
+// position plus a store to the cell. `capacity` is rounded up to a power of 2.
+template <class T>
+class BoundedQueue {
+ public:
+  BoundedQueue(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    mask = size - 1;
+    cells = std::make_unique<Cell[]>(size);
+    for (size_t i = 0; i < size; i++) {
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+  };
+
+  // false if the queue is full
+  bool try_push(T&& value) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells[pos & mask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      auto diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+  // false if the queue is empty
+  bool try_pop(T& value) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells[pos & mask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      auto diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+      if (diff == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+    value = std::move(cell->value);
+    cell->seq.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T value;
+  };
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  // producers and consumers spin on different cache lines
+  alignas(64) std::atomic<size_t> tail{0};
+  alignas(64) std::atomic<size_t> head{0};
+};
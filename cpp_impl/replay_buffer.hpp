@@ -1,33 +1,327 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <span>
 #include <sstream>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 #include "board.hpp"
 #include "episode.hpp"
+#include "episode_file.hpp"
+#include "mapped_file.hpp"
+
+class ReplayBuffer;
+
+// One episode held by a `ReplayBuffer`: its steps are `size()` consecutive
+// entries of the buffer's step arrays. Valid until the buffer is pushed to.
+class EpisodeView {
+ public:
+  Board init_state;
+  float scores[2];
+  clock_t time;
+  size_t size() const { return step_states.size(); }
+  Board::Action action(size_t t) const { return step_actions[t]; }
+  Board::Reward reward(size_t t) const { return step_rewards[t]; }
+  const Board& state(size_t t) const { return step_states[t]; }
+  std::span<const Board> states() const { return step_states; }
+  // an owning copy
+  Episode episode() const {
+    Episode ep(init_state);
+    ep.scores[0] = scores[0];
+    ep.scores[1] = scores[1];
+    ep.time = time;
+    for (size_t t = 0; t < size(); t++) {
+      ep.add({action(t), reward(t), state(t)});
+    }
+    return ep;
+  }
+
+ private:
+  friend class ReplayBuffer;
+  const uint8_t* step_actions;
+  const Board::Reward* step_rewards;
+  std::span<const Board> step_states;
+};
+
+// Episodes of a `ReplayBuffer` picked by slot, e.g. a train or test split.
+// Shuffling and splitting only move the slot indices around.
+class EpisodeSet {
+ public:
+  EpisodeSet(const ReplayBuffer& buffer, std::vector<uint32_t> slots)
+      : buffer(&buffer), slots(std::move(slots)) {}
+  size_t size() const { return slots.size(); }
+  EpisodeView operator[](size_t i) const;
+  void shuffle() {
+    thread_local std::mt19937 gen(std::random_device{}());
+    std::shuffle(slots.begin(), slots.end(), gen);
+  }
+  // the first `ratio` of the episodes, and the rest
+  std::tuple<EpisodeSet, EpisodeSet> split(const float ratio) const {
+    const size_t n = size_t(slots.size() * ratio);
+    return {EpisodeSet(*buffer, {slots.begin(), slots.begin() + n}),
+            EpisodeSet(*buffer, {slots.begin() + n, slots.end()})};
+  }
+  // every `stride`-th state, e.g. to calibrate a quantized network on
+  // positions from real games
+  std::vector<Board> states(size_t stride = 1) const {
+    std::vector<Board> result;
+    size_t i = 0;
+    for (size_t j = 0; j < size(); j++) {
+      for (const auto& b : (*this)[j].states()) {
+        if (i++ % stride == 0) result.push_back(b);
+      }
+    }
+    return result;
+  }
+
+  struct iterator {
+    const EpisodeSet* set;
+    size_t i;
+    EpisodeView operator*() const { return (*set)[i]; }
+    iterator& operator++() {
+      ++i;
+      return *this;
+    }
+    bool operator!=(const iterator& o) const { return i != o.i; }
+  };
+  iterator begin() const { return {this, 0}; }
+  iterator end() const { return {this, size()}; }
+
+ private:
+  const ReplayBuffer* buffer;
+  std::vector<uint32_t> slots;
+};
+
+// Sums and maxima of step priorities over the ring positions of a
+// `ReplayBuffer`, as two implicit binary trees whose leaves are the
+// positions (0 on the gaps): setting one priority and drawing a position in
+// proportion to priority are both O(log n).
+class PriorityTree {
+ public:
+  void resize(size_t n) {
+    leaves = std::bit_ceil(std::max<size_t>(n, 1));
+    sums.assign(2 * leaves, 0);
+    maxes.assign(2 * leaves, 0);
+  }
+  Board::Reward get(size_t i) const { return sums[leaves + i]; }
+  void set(size_t i, Board::Reward p) {
+    i += leaves;
+    sums[i] = maxes[i] = p;
+    for (i /= 2; i; i /= 2) pull(i);
+  }
+  // write leaves without updating the sums, then `rebuild`; writes to
+  // different leaves may come from different threads
+  void set_leaf(size_t i, Board::Reward p) {
+    sums[leaves + i] = maxes[leaves + i] = p;
+  }
+  void rebuild() {
+    for (size_t i = leaves - 1; i; i--) pull(i);
+  }
+  Board::Reward total() const { return sums[1]; }
+  Board::Reward max() const { return maxes[1]; }
+  // the position where the running sum of priorities passes `u`, for
+  // 0 <= u < total()
+  size_t find(Board::Reward u) const {
+    size_t i = 1;
+    while (i < leaves) {
+      i *= 2;
+      if (u >= sums[i]) {
+        u -= sums[i];
+        i++;
+      }
+    }
+    return i - leaves;
+  }
+
+ private:
+  size_t leaves = 0;
+  std::vector<Board::Reward> sums, maxes;
+  void pull(size_t i) {
+    sums[i] = sums[2 * i] + sums[2 * i + 1];
+    maxes[i] = std::max(maxes[2 * i], maxes[2 * i + 1]);
+  }
+};
+
+// FIFO of the last `capacity` episodes. The steps of all episodes live in
+// one ring of flat arrays (actions, rewards, states, owners), each
+// episode a contiguous run in it, so pushing never moves other episodes
+// and dropping the oldest costs only its own steps. Step priorities are
+// kept in a `PriorityTree` over the same ring. The ring only grows, by
+// doubling, when a new episode doesn't fit in the space the evicted ones
+// left.
 class ReplayBuffer {
  public:
-  std::vector<Episode> buffer;
   size_t capacity;
-  ReplayBuffer(size_t capacity) : capacity(capacity) {
-    buffer.reserve(capacity);
+  ReplayBuffer(size_t capacity) : capacity(capacity), meta(capacity) {
+    priorities.resize(0);
+  }
+
+  // a step, as the slot of its episode and its index in it
+  struct StepRef {
+    uint32_t slot;
+    uint32_t t;
   };
-  ReplayBuffer(std::vector<Episode> buffer)
-      : buffer(buffer), capacity(buffer.size()){};
-  void push(const Episode& s) {
-    if (buffer.size() >= capacity) {
-      buffer.erase(buffer.begin());
+
+  void push(const Episode& ep) {
+    if (!capacity) return;
+    if (count == capacity) pop();
+    const size_t length = ep.size();
+    size_t offset;
+    if (!fits(length, offset)) {
+      grow(length);
+      offset = used;
+    }
+    if (!used) head = offset;
+    const uint32_t slot = (first + count) % capacity;
+    meta[slot] = {offset, uint32_t(length), ep.init_state,
+                  {ep.scores[0], ep.scores[1]}, ep.time, pushed};
+    const Board::Reward p = new_priority();
+    for (size_t t = 0; t < length; t++) {
+      step_actions[offset + t] = ep.action(t);
+      step_rewards[offset + t] = ep.reward(t);
+      step_states[offset + t] = ep.state(t);
+      priorities.set(offset + t, p);
+      step_owner[offset + t] = slot;
+    }
+    tail = offset + length;
+    used += length;
+    pushed += length;
+    count++;
+  }
+  // episodes held, oldest first by `(*this)[i]`
+  size_t size() const { return count; }
+  // steps held
+  size_t steps() const { return used; }
+  // steps the ring has room for
+  size_t ring_size() const { return step_owner.size(); }
+  EpisodeView operator[](size_t i) const {
+    return view((first + i) % capacity);
+  }
+  EpisodeView view(uint32_t slot) const {
+    const Meta& m = meta[slot];
+    EpisodeView v;
+    v.init_state = m.init_state;
+    v.scores[0] = m.scores[0];
+    v.scores[1] = m.scores[1];
+    v.time = m.time;
+    v.step_actions = step_actions.data() + m.offset;
+    v.step_rewards = step_rewards.data() + m.offset;
+    v.step_states = {step_states.data() + m.offset, m.length};
+    return v;
+  }
+  // all episodes, oldest first
+  EpisodeSet episodes() const {
+    std::vector<uint32_t> slots(count);
+    for (size_t i = 0; i < count; i++) slots[i] = (first + i) % capacity;
+    return EpisodeSet(*this, std::move(slots));
+  }
+
+  EpisodeView sample() {
+    assert(count && "sample from an empty buffer");
+    std::uniform_int_distribution<size_t> dist(0, count - 1);
+    return (*this)[dist(gen)];
+  }
+  // Uniform over all held steps: one draw among the step numbers held,
+  // mapped to its episode by binary search over their `before` counts,
+  // O(log n) however sparse the ring is.
+  StepRef sample_step() {
+    assert(used && "sample from a buffer without steps");
+    std::uniform_int_distribution<uint64_t> dist(0, used - 1);
+    const uint64_t step = meta[first].before + dist(gen);
+    // the last episode starting at or before `step`; empty episodes share
+    // the count of the one after them, so they are never the last
+    size_t lo = 0, hi = count - 1;
+    while (lo < hi) {
+      const size_t mid = (lo + hi + 1) / 2;
+      if (meta[(first + mid) % capacity].before <= step) {
+        lo = mid;
+      } else {
+        hi = mid - 1;
+      }
+    }
+    const uint32_t slot = (first + lo) % capacity;
+    return {slot, uint32_t(step - meta[slot].before)};
+  }
+  // Proportional to `priority`, in O(log n) through the priority tree. New
+  // steps get the highest priority held, so they are seen at least once
+  // soon; uniform if every priority is 0.
+  StepRef sample_prioritized() {
+    assert(used && "sample from a buffer without steps");
+    if (!(priorities.total() > 0)) return sample_step();
+    std::uniform_real_distribution<Board::Reward> dist(0, priorities.total());
+    while (true) {
+      // rounding in the sums can very rarely land on a gap; draw again
+      const size_t i = priorities.find(dist(gen));
+      const uint32_t slot = i < step_owner.size() ? step_owner[i] : none;
+      if (slot != none && priorities.get(i) > 0) {
+        return {slot, uint32_t(i - meta[slot].offset)};
+      }
     }
-    buffer.push_back(s);
   }
-  Episode sample() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    std::uniform_int_distribution<size_t> dist(0, buffer.size() - 1);
-    return buffer[dist(gen)];
+  Board::Reward priority(StepRef s) const {
+    return priorities.get(meta[s.slot].offset + s.t);
+  }
+  void set_priority(StepRef s, Board::Reward p) {
+    priorities.set(meta[s.slot].offset + s.t, p);
   }
-  size_t size() { return buffer.size(); }
 
+  // binary episode files (see episode_file.hpp) or the legacy text format
   void load(const std::string& filename) {
+    if (is_episode_file(filename)) {
+      EpisodeReader(filename).for_each(
+          [&](const Episode& ep, uint64_t) { push(ep); });
+      return;
+    }
+    read_text(filename, [&](const Episode& ep, int) { push(ep); });
+  };
+  // The same as `load` on each file in turn, but text files are mapped, cut
+  // into chunks at line boundaries and parsed on `threads` threads with
+  // from_chars. A first pass counts the steps on every line, so each
+  // episode that survives eviction gets its run in the step ring up front
+  // and the second pass parses straight into it. Blank lines are skipped.
+  void load(std::span<const std::string> filenames, int threads) {
+    std::vector<std::unique_ptr<MappedFile>> files;
+    std::vector<TextChunk> chunks;
+    auto flush = [&] {
+      load_chunks(chunks, threads);
+      chunks.clear();
+      files.clear();
+    };
+    for (const auto& filename : filenames) {
+      if (is_episode_file(filename)) {
+        flush();
+        load(filename);
+        continue;
+      }
+      files.push_back(std::make_unique<MappedFile>(filename));
+      const MappedFile& file = *files.back();
+      if (!file.is_open()) continue;
+      const char* p = file.data();
+      const char* end = p + file.size();
+      while (p < end) {
+        const char* cut = std::min(end, p + text_chunk_bytes);
+        cut = std::find(cut, end, '\n');
+        cut += cut < end;
+        chunks.push_back({p, cut});
+        p = cut;
+      }
+    }
+    flush();
+  }
+  // one episode per line: id, scores, time, the initial board and then
+  // action, reward, state for every step; `f(ep, id)` per line
+  template <class F>
+  static void read_text(const std::string& filename, F&& f) {
     std::ifstream in(filename);
     std::string line;
     while (std::getline(in, line)) {
@@ -38,7 +332,8 @@ class ReplayBuffer {
       ss >> ep.scores[0] >> ep.scores[1] >> ep.time;
       ss >> ep.init_state;
       while (true) {
-        int action, reward;
+        int action;
+        Board::Reward reward;
         Board state;
         Episode::Step step;
         ss >> action >> reward >> state;
@@ -48,23 +343,281 @@ class ReplayBuffer {
         if (ss.eof()) break;
         ep.history.push_back(step);
       }
-      push(ep);
+      f(ep, id);
     }
     in.close();
   };
-  void shuffle() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    std::shuffle(buffer.begin(), buffer.end(), gen);
+  // every `stride`-th state of the buffered episodes
+  std::vector<Board> states(size_t stride = 1) const {
+    return episodes().states(stride);
+  }
+
+ private:
+  static constexpr uint32_t none = UINT32_MAX;
+  struct Meta {
+    size_t offset;
+    uint32_t length;
+    Board init_state;
+    float scores[2];
+    clock_t time;
+    // steps pushed before this episode; the held steps are numbered
+    // `meta[first].before` up to `pushed`
+    uint64_t before;
   };
-  std::tuple<ReplayBuffer, ReplayBuffer> split(const float ratio) {
-    ReplayBuffer buffer1(
-        {buffer.begin(), buffer.begin() + size_t(capacity * ratio)});
-    ReplayBuffer buffer2(
-        {buffer.begin() + size_t(capacity * ratio), buffer.end()});
-    return {buffer1, buffer2};
+  std::vector<Meta> meta;
+  size_t first = 0, count = 0;
+  // step ring; live steps run from `head` to `tail`, possibly wrapping, with
+  // `owner` none on the gaps. `head` is where the oldest episode that has
+  // steps starts, or the end of the last popped one when a wrap gap
+  // follows, so empty episodes have no say in it.
+  std::vector<uint8_t> step_actions;
+  std::vector<Board::Reward> step_rewards;
+  std::vector<Board> step_states;
+  std::vector<uint32_t> step_owner;
+  PriorityTree priorities;
+  size_t head = 0, tail = 0, used = 0;
+  uint64_t pushed = 0;
+  // for new steps: the highest priority held, 1 if none
+  Board::Reward new_priority() const {
+    return priorities.max() > 0 ? priorities.max() : 1;
+  }
+  std::mt19937 gen{std::random_device{}()};
+
+  static constexpr size_t text_chunk_bytes = 1 << 20;
+  static constexpr uint32_t blank = UINT32_MAX;
+  struct TextChunk {
+    const char* begin;
+    const char* end;
+    // steps on each line, `blank` for lines without an episode
+    std::vector<uint32_t> steps = {};
+    size_t first_episode = 0;
+    size_t first_offset = 0;
+    // slots of the lines that didn't parse
+    std::vector<uint32_t> malformed = {};
   };
-  // overload iterator to iterate over buffer
-  std::vector<Episode>::iterator begin() { return buffer.begin(); };
-  std::vector<Episode>::iterator end() { return buffer.end(); };
-};
\ No newline at end of file
+  template <class F>
+  static void for_each_line(const TextChunk& c, F&& f) {
+    for (const char* p = c.begin; p < c.end;) {
+      auto* eol = static_cast<const char*>(std::memchr(p, '\n', c.end - p));
+      if (!eol) eol = c.end;
+      f(p, eol);
+      p = eol + 1;
+    }
+  }
+  void load_chunks(std::vector<TextChunk>& chunks, int threads) {
+    if (chunks.empty()) return;
+    auto parallel = [&](auto&& work) {
+      std::atomic<size_t> next = 0;
+      auto worker = [&] {
+        for (size_t j; (j = next.fetch_add(1)) < chunks.size();) {
+          work(chunks[j]);
+        }
+      };
+      std::vector<std::thread> pool;
+      for (int t = 1; t < threads; t++) pool.emplace_back(worker);
+      worker();
+      for (auto& t : pool) t.join();
+    };
+
+    // id, 2 scores, time and the initial board, then 3 tokens per step
+    // (a token starts at every non-blank byte after a blank one; written
+    // without a carried flag so the loop vectorizes)
+    parallel([](TextChunk& c) {
+      for_each_line(c, [&](const char* p, const char* eol) {
+        const size_t n = eol - p;
+        size_t tokens = n && uint8_t(p[0]) > ' ';
+        for (size_t i = 1; i < n; i++) {
+          tokens += (uint8_t(p[i - 1]) <= ' ') & (uint8_t(p[i]) > ' ');
+        }
+        c.steps.push_back(tokens < 5 ? blank : (tokens - 5) / 3);
+      });
+    });
+
+    // only the last `capacity` episodes stay, older ones are skipped
+    size_t episodes = 0;
+    for (auto& c : chunks) {
+      c.first_episode = episodes;
+      episodes += std::count_if(c.steps.begin(), c.steps.end(),
+                                [](uint32_t n) { return n != blank; });
+    }
+    const size_t skip = episodes > capacity ? episodes - capacity : 0;
+    while (count && count + episodes - skip > capacity) pop();
+    size_t total = 0, e = 0;
+    for (auto& c : chunks) {
+      c.first_offset = total;
+      for (auto n : c.steps) {
+        if (n != blank && e++ >= skip) total += n;
+      }
+    }
+    size_t base;
+    if (!fits(total, base)) {
+      grow(total);
+      base = used;
+    }
+    const Board::Reward priority = new_priority();
+
+    parallel([&](TextChunk& c) {
+      size_t e = c.first_episode, offset = base + c.first_offset, line = 0;
+      for_each_line(c, [&](const char* p, const char* eol) {
+        const uint32_t n = c.steps[line++];
+        if (n == blank || e++ < skip) return;
+        bool ok = true;
+        auto next = [&](auto& v) {
+          while (p < eol && uint8_t(*p) <= ' ') p++;
+          auto [q, ec] = std::from_chars(p, eol, v);
+          ok &= ec == std::errc();
+          p = q;
+        };
+        // rewards and scores are whole numbers in practice, and the integer
+        // parse is much cheaper than the float one
+        auto next_real = [&](Board::Reward& v) {
+          while (p < eol && uint8_t(*p) <= ' ') p++;
+          int i;
+          auto [q, ec] = std::from_chars(p, eol, i);
+          if (ec == std::errc() && (q == eol || uint8_t(*q) <= ' ')) {
+            v = i;
+            p = q;
+          } else {
+            auto [q, ec] = std::from_chars(p, eol, v);
+            ok &= ec == std::errc();
+            p = q;
+          }
+        };
+        const uint32_t slot = (first + count + e - 1 - skip) % capacity;
+        Meta& m = meta[slot];
+        int id = 0;
+        uint64_t raw = 0;
+        next(id);
+        next_real(m.scores[0]);
+        next_real(m.scores[1]);
+        next(m.time);
+        next(raw);
+        m.init_state = raw;
+        m.offset = offset;
+        m.length = n;
+        m.before = pushed + (offset - base);
+        for (size_t t = 0; t < n; t++, offset++) {
+          int action = 0;
+          next(action);
+          next_real(step_rewards[offset]);
+          next(raw);
+          ok &= action >= 0 && action < 18;
+          step_actions[offset] = action;
+          step_states[offset] = raw;
+          priorities.set_leaf(offset, priority);
+          step_owner[offset] = slot;
+        }
+        if (!ok) c.malformed.push_back(slot);
+      });
+    });
+    priorities.rebuild();
+    const size_t loaded = episodes - skip;
+    count += loaded;
+    if (!used) head = base;
+    used += total;
+    pushed += total;
+    tail = base + total;
+
+    // the slots of malformed lines are dropped and the later episodes of
+    // this load move down to close the gaps; their steps stay where they are
+    std::vector<bool> malformed(capacity);
+    size_t bad = 0;
+    for (const auto& c : chunks) {
+      for (auto slot : c.malformed) malformed[slot] = true;
+      bad += c.malformed.size();
+    }
+    if (!bad) return;
+    std::cout << "Skipped " << bad << " malformed episode lines" << std::endl;
+    const size_t start = count - loaded;
+    size_t kept = 0;
+    pushed -= total;
+    for (size_t i = 0; i < loaded; i++) {
+      const uint32_t from = (first + start + i) % capacity;
+      const Meta& m = meta[from];
+      if (malformed[from]) {
+        std::fill_n(step_owner.begin() + m.offset, m.length, none);
+        for (size_t t = 0; t < m.length; t++) priorities.set(m.offset + t, 0);
+        used -= m.length;
+        continue;
+      }
+      const uint32_t to = (first + start + kept++) % capacity;
+      meta[to] = m;
+      meta[to].before = pushed;
+      pushed += m.length;
+      if (to != from) {
+        std::fill_n(step_owner.begin() + m.offset, m.length, to);
+      }
+    }
+    count = start + kept;
+  }
+
+  void pop() {
+    const Meta& m = meta[first];
+    std::fill_n(step_owner.begin() + m.offset, m.length, none);
+    for (size_t t = 0; t < m.length; t++) priorities.set(m.offset + t, 0);
+    if (m.length) head = m.offset + m.length;
+    used -= m.length;
+    first = (first + 1) % capacity;
+    count--;
+  }
+  // a free run of `length` steps at `tail`, or at the start of the ring if
+  // the end is too short; the ring is never filled up to `head`, so `tail`
+  // == `head` only ever means no steps are held
+  bool fits(size_t length, size_t& offset) const {
+    const size_t size = step_owner.size();
+    if (!used) {
+      offset = 0;
+      return length <= size;
+    }
+    if (tail > head) {
+      if (tail + length <= size) {
+        offset = tail;
+        return true;
+      }
+      offset = 0;
+      return length < head;
+    }
+    offset = tail;
+    return tail + length < head;
+  }
+  // reallocate with the live episodes packed at the start, oldest first
+  void grow(size_t length) {
+    const size_t size =
+        std::max({step_owner.size() * 2, used + length, size_t(1024)});
+    std::vector<uint8_t> new_actions(size);
+    std::vector<Board::Reward> new_rewards(size);
+    std::vector<Board> new_states(size);
+    PriorityTree new_priorities;
+    new_priorities.resize(size);
+    std::vector<uint32_t> new_owner(size, none);
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+      const uint32_t slot = (first + i) % capacity;
+      Meta& m = meta[slot];
+      std::copy_n(step_actions.begin() + m.offset, m.length,
+                  new_actions.begin() + offset);
+      std::copy_n(step_rewards.begin() + m.offset, m.length,
+                  new_rewards.begin() + offset);
+      std::copy_n(step_states.begin() + m.offset, m.length,
+                  new_states.begin() + offset);
+      for (size_t t = 0; t < m.length; t++) {
+        new_priorities.set_leaf(offset + t, priorities.get(m.offset + t));
+      }
+      std::fill_n(new_owner.begin() + offset, m.length, slot);
+      m.offset = offset;
+      offset += m.length;
+    }
+    step_actions.swap(new_actions);
+    step_rewards.swap(new_rewards);
+    step_states.swap(new_states);
+    new_priorities.rebuild();
+    priorities = std::move(new_priorities);
+    step_owner.swap(new_owner);
+    head = 0;
+    tail = offset;
+  }
+};
+
+inline EpisodeView EpisodeSet::operator[](size_t i) const {
+  return buffer->view(slots[i]);
+}
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <random>
+
+#include "replay_buffer.hpp"
+
+// Checks the step ring of `ReplayBuffer` against a std::deque of the last
+// `capacity` episodes over random pushes, with empty episodes mixed in, and
+// that the ring stays within a small multiple of the steps it holds, that
+// samples are held steps and uniform ones stay uniform on a sparse ring.
+// Exits non-zero on the first mismatch.
+int fail(const std::string& what, size_t round) {
+  std::cout << "FAIL round " << round << ": " << what << std::endl;
+  return 1;
+}
+
+int main(int argc, const char* argv[]) {
+  std::mt19937 gen(2048);
+  size_t id = 0;
+  auto make_episode = [&](size_t length) {
+    Episode ep(Board(id++));
+    for (size_t t = 0; t < length; t++) {
+      ep.add({int(gen() % 18), Board::Reward(gen() % 16), Board(gen())});
+    }
+    return ep;
+  };
+  auto same = [](const EpisodeView& v, const Episode& ep) {
+    if (v.size() != ep.size() || v.init_state.hash() != ep.init_state.hash()) {
+      return false;
+    }
+    for (size_t t = 0; t < v.size(); t++) {
+      if (v.action(t) != ep.action(t) || v.reward(t) != ep.reward(t) ||
+          v.state(t).hash() != ep.state(t).hash()) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  // alternating 5 and 0 step episodes once doubled the ring on every push
+  ReplayBuffer alternating(2);
+  for (int i = 0; i < 64; i++) {
+    alternating.push(make_episode(i % 2 ? 0 : 5));
+    if (alternating.ring_size() > 1024) return fail("ring grew on empty", 0);
+  }
+
+  for (size_t round = 0; round < 100; round++) {
+    const size_t capacity = 1 + gen() % 16;
+    ReplayBuffer buffer(capacity);
+    std::deque<Episode> expect;
+    size_t max_steps = 0;
+    for (int i = 0; i < 500; i++) {
+      // about 1 in 4 empty, the rest up to 300 steps so the ring wraps
+      const size_t length = gen() % 4 ? gen() % 300 : 0;
+      Episode ep = make_episode(length);
+      buffer.push(ep);
+      expect.push_back(ep);
+      if (expect.size() > capacity) expect.pop_front();
+
+      size_t steps = 0;
+      for (const auto& e : expect) steps += e.size();
+      max_steps = std::max(max_steps, steps);
+      if (buffer.size() != expect.size()) return fail("episode count", round);
+      if (buffer.steps() != steps) return fail("step count", round);
+      for (size_t j = 0; j < expect.size(); j++) {
+        if (!same(buffer[j], expect[j])) return fail("episode contents", round);
+      }
+      if (buffer.ring_size() > std::max<size_t>(1024, 4 * max_steps)) {
+        return fail("ring size " + std::to_string(buffer.ring_size()), round);
+      }
+      if (steps) {
+        const auto u = buffer.sample_step();
+        if (u.t >= buffer.view(u.slot).size()) {
+          return fail("uniform sample", round);
+        }
+        const auto s = buffer.sample_prioritized();
+        if (s.t >= buffer.view(s.slot).size() || !(buffer.priority(s) > 0)) {
+          return fail("prioritized sample", round);
+        }
+        buffer.set_priority(s, Board::Reward(1 + gen() % 100));
+      }
+    }
+  }
+
+  // long episodes grow the ring, the short ones after them leave it sparse
+  ReplayBuffer sparse(4);
+  for (int i = 0; i < 4; i++) sparse.push(make_episode(3000));
+  for (size_t length : {1, 0, 2, 3}) sparse.push(make_episode(length));
+  std::vector<size_t> hits(sparse.size() * 3);
+  const size_t draws = 60000;
+  for (size_t i = 0; i < draws; i++) {
+    const auto s = sparse.sample_step();
+    size_t j = 0;
+    while (j < sparse.size() && sparse.view(s.slot).init_state.hash() !=
+                                    sparse[j].init_state.hash()) {
+      j++;
+    }
+    if (j == sparse.size() || s.t >= sparse[j].size()) {
+      return fail("sparse sample", 0);
+    }
+    hits[j * 3 + s.t]++;
+  }
+  for (size_t j = 0; j < sparse.size(); j++) {
+    for (size_t t = 0; t < sparse[j].size(); t++) {
+      const size_t n = hits[j * 3 + t], mean = draws / sparse.steps();
+      if (n < mean * 9 / 10 || n > mean * 11 / 10) {
+        return fail("sparse sample counts", 0);
+      }
+    }
+  }
+  std::cout << "replay buffer ring: ok" << std::endl;
+}
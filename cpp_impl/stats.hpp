@@ -0,0 +1,84 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// Per-search counters. Build with -DNO_SEARCH_STATS to compile every
+// `STATS(...)` statement out of the search loops.
+#ifdef NO_SEARCH_STATS
+#define STATS(expr)
+#else
+#define STATS(expr) expr
+#endif
+
+struct SearchStats {
+  using Clock = std::chrono::steady_clock;
+
+  std::string player;
+  Clock::time_point start;
+  uint64_t elapsed_ns = 0;
+
+  // alpha-beta
+  uint64_t nodes = 0;
+  uint64_t tt_probes = 0;
+  uint64_t tt_hits = 0;
+  uint64_t beta_cutoffs = 0;
+  uint64_t first_move_cutoffs = 0;
+  uint64_t eval_probes = 0;
+  uint64_t eval_hits = 0;
+
+  // mcts
+  uint64_t simulations = 0;
+  uint64_t tree_size = 0;
+  uint64_t depth_sum = 0;
+  int max_depth = 0;
+  uint64_t select_ns = 0;
+  uint64_t expand_ns = 0;
+  uint64_t rollout_ns = 0;
+  uint64_t backprop_ns = 0;
+
+  SearchStats(const std::string& player = "") : player(player){};
+
+  void begin() {
+    *this = SearchStats(player);
+    start = Clock::now();
+  }
+  void end() { elapsed_ns = ns(Clock::now() - start); }
+
+  static uint64_t ns(Clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  }
+  static double ratio(uint64_t a, uint64_t b) { return b ? double(a) / b : 0; }
+  double seconds() const { return elapsed_ns * 1e-9; }
+  double nodes_per_sec() const { return ratio(nodes, elapsed_ns) * 1e9; }
+  double sims_per_sec() const { return ratio(simulations, elapsed_ns) * 1e9; }
+  double tt_hit_rate() const { return ratio(tt_hits, tt_probes); }
+  double first_move_cutoff_rate() const {
+    return ratio(first_move_cutoffs, beta_cutoffs);
+  }
+  double eval_hit_rate() const { return ratio(eval_hits, eval_probes); }
+  double avg_depth() const { return ratio(depth_sum, simulations); }
+
+  // one JSON object per line, so logs can be appended and grepped
+  void write_json(std::ostream& os) const {
+    auto ms = [](uint64_t ns) { return ns * 1e-6; };
+    os << "{\"player\":\"" << player << "\",\"elapsed_ms\":" << ms(elapsed_ns)
+       << ",\"nodes\":" << nodes << ",\"nps\":" << nodes_per_sec()
+       << ",\"tt_probes\":" << tt_probes << ",\"tt_hits\":" << tt_hits
+       << ",\"tt_hit_rate\":" << tt_hit_rate()
+       << ",\"beta_cutoffs\":" << beta_cutoffs
+       << ",\"first_move_cutoff_rate\":" << first_move_cutoff_rate()
+       << ",\"eval_probes\":" << eval_probes
+       << ",\"eval_hits\":" << eval_hits
+       << ",\"eval_hit_rate\":" << eval_hit_rate()
+       << ",\"simulations\":" << simulations
+       << ",\"sims_per_sec\":" << sims_per_sec()
+       << ",\"tree_size\":" << tree_size << ",\"max_depth\":" << max_depth
+       << ",\"avg_depth\":" << avg_depth()
+       << ",\"select_ms\":" << ms(select_ns)
+       << ",\"expand_ms\":" << ms(expand_ns)
+       << ",\"rollout_ms\":" << ms(rollout_ns)
+       << ",\"backprop_ms\":" << ms(backprop_ns) << "}\n";
+  }
+};
@@ -1,25 +1,99 @@
+#include <chrono>
 #include <ctime>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include "board.hpp"
 #include "episode.hpp"
+#include "mlp.hpp"
 #include "net.hpp"
 #include "replay_buffer.hpp"
+#include "training.hpp"
 
-int main() {
+// options: threads=N (TD workers, default 1; more train Hogwild style, so
+// losses differ from run to run), sync=K (buffer updates, apply every K
+// episodes; 0 writes the shared tables directly), parity (also train a
+// single-threaded copy and print its losses next to the parallel ones),
+// stream=W (don't load the training files: stream them from disk every epoch
+// through a shuffle window of W episodes, holding out the last file as the
+// test set, so memory doesn't grow with the data), aggregate (merge the
+// training states that are equal up to symmetry and train on each once,
+// weighted by its count; ignored with stream), cache (compute the table
+// indices of every training state once and train epochs from them)
+int main(int argc, const char* argv[]) {
   std::srand(123);
   // std::srand(std::time(nullptr));
+  int threads = 1;
+  // loading, aggregating and caching come out the same on any number of
+  // threads
+  const int io_threads = std::max(1u, std::thread::hardware_concurrency());
+  int sync = 0;
+  bool parity = false;
+  size_t stream_window = 0;
+  bool aggregated = false;
+  bool cached = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto match_arg = [&](std::string flag) -> bool {
+      auto it = arg.find_first_not_of('-');
+      return arg.find(flag, it) == it;
+    };
+    auto next_opt = [&]() -> std::string {
+      auto it = arg.find('=') + 1;
+      return it ? arg.substr(it) : argv[++i];
+    };
+    if (match_arg("threads")) {
+      threads = std::max(1, std::stoi(next_opt()));
+    } else if (match_arg("sync")) {
+      sync = std::stoi(next_opt());
+    } else if (match_arg("parity")) {
+      parity = true;
+    } else if (match_arg("stream")) {
+      stream_window = std::stoul(next_opt());
+    } else if (match_arg("aggregate")) {
+      aggregated = true;
+    } else if (match_arg("cache")) {
+      cached = true;
+    }
+  }
   const size_t EPOCHS = 20;
   Board::Reward lr = 0.0001;
   Board::Reward lambda = 0.01;
   ReplayBuffer buffer(6000);
   int n = 30;
+  std::vector<std::string> files;
   for (int i = 0; i < n; i++) {
-    Episode ep;
-    buffer.load("trajectory/" + std::to_string(i) + "_0M1k50000sim.episode");
+    files.push_back("trajectory/" + std::to_string(i) +
+                    "_0M1k50000sim.episode");
+  }
+  std::vector<std::string> stream_files;
+  if (stream_window) {
+    stream_files.assign(files.begin(), files.end() - 1);
+    files.erase(files.begin(), files.end() - 1);
+  }
+  auto load_begin = std::chrono::steady_clock::now();
+  buffer.load(files, io_threads);
+  std::chrono::duration<double> load_time =
+      std::chrono::steady_clock::now() - load_begin;
+  std::cout << "Loaded " << buffer.size() << " episodes, " << buffer.steps()
+            << " steps in " << load_time.count() << " sec" << std::endl;
+  auto episodes = buffer.episodes();
+  episodes.shuffle();
+  // in stream mode everything loaded is the held-out file
+  auto&& [train_set, test_set] = episodes.split(stream_window ? 0 : 0.8);
+  Aggregate merged;
+  if (aggregated && !stream_window) {
+    auto begin = std::chrono::steady_clock::now();
+    merged = aggregate(train_set, io_threads);
+    std::chrono::duration<double> wall =
+        std::chrono::steady_clock::now() - begin;
+    std::cout << "Aggregated " << merged.states << " states into "
+              << merged.positions.size() << " positions, "
+              << merged.transitions.size() << " transitions in "
+              << wall.count() << " sec" << std::endl;
   }
-  buffer.shuffle();
-  auto&& [train_set, test_set] = buffer.split(0.8);
   // auto net = TupleNet<3, 8>({{{0,1,2}, {3,4,5}, {6,7,8}, {0,3,6}, {1,4,7},
   // {2,5,8}, {0,4,8}, {2,4,6}}}); auto net = TupleNet<3, 3>({{{0,1,2}, {3,4,5},
   // {0,4,8}}}); auto net = TupleNet<3,16>({{
@@ -35,7 +109,20 @@ int main() {
   //                            {0, 4, 8},
   //                            {2, 4, 6},
   //                            }});
+  // auto net = MLP({64, 32});
   auto net = NewNet<3, 8>("model/3_8_newNet.model");
+  auto ref = NewNet<3, 8>("model/3_8_newNet.model");
+  std::unique_ptr<FeatureCache<decltype(net)>> cache;
+  if (cached && !stream_window && !aggregated) {
+    auto begin = std::chrono::steady_clock::now();
+    cache = std::make_unique<FeatureCache<decltype(net)>>(net, train_set,
+                                                          io_threads);
+    std::chrono::duration<double> wall =
+        std::chrono::steady_clock::now() - begin;
+    std::cout << "Cached the features of " << cache->size() << " episodes, "
+              << cache->bytes() / (1 << 20) << " MB in " << wall.count()
+              << " sec" << std::endl;
+  }
 
 
   // auto net = TupleNet<3,16>("model/3_16_0.01_0.02.model");
@@ -45,28 +132,26 @@ int main() {
       lr *= .9;
       lambda *= 1.05;
     }
-    Board::Reward train_loss = 0;
-    clock_t begin_time = clock();
-    train_set.shuffle();
-    for (auto ep : train_set) {
-      Board::Reward target = 0;
-      Board::Reward loss = 0;
-      const int size = ep.size();
-      Board b = ep.init_state;
-      for (; ep.history.size(); ep.history.pop_back()) {
-        const auto& [action, reward, b_next] = ep.history.back();
-        Board::Reward error = target - net.evaluate(b_next);
-        // std::cout << target << " " << net.evaluate(b_next) << std::endl;
-        loss += std::abs(error);
-        net.update_net(b_next, error, lr);
-        // net.update_weights(b_next, error, lr, lambda);
-
-        target = reward - net.evaluate(b_next);
-      }
-      net.update_net(b, target - net.evaluate(b), lr);
-      // net.update_weights(b, target - net.evaluate(b), lr, lambda);
-      train_loss += loss / size;
+    auto begin_time = std::chrono::steady_clock::now();
+    // mean per-episode loss, or per-state for aggregated samples
+    Board::Reward train_loss;
+    if (stream_window) {
+      EpisodeStream stream(stream_files, stream_window);
+      auto&& [loss, streamed] = train_stream(net, stream, lr, threads, sync);
+      train_loss = loss / streamed;
+    } else if (aggregated) {
+      merged.shuffle();
+      train_loss = train_aggregate(net, merged, lr, threads, sync);
+    } else if (cache) {
+      cache->shuffle();
+      train_loss = train_cached(net, *cache, lr, threads, sync) / cache->size();
+    } else {
+      train_set.shuffle();
+      train_loss =
+          train_epoch(net, train_set, lr, threads, sync) / train_set.size();
     }
+    std::chrono::duration<double> wall =
+        std::chrono::steady_clock::now() - begin_time;
     // std::cout.precision(2);
     // for (const auto& w : net.weights) {
     //   std::cout << w << " ";
@@ -76,26 +161,18 @@ int main() {
     //   std::cout << w << " ";
     // }
     std::cout << std::endl;
-    Board::Reward test_loss = 0;
-
-    for (auto ep : test_set) {
-      Board::Reward target = 0;
-      Board::Reward loss = 0;
-      const int size = ep.size();
-      Board b = ep.init_state;
-      for (; ep.history.size(); ep.history.pop_back()) {
-        const auto& [action, reward, b_next] = ep.history.back();
-        Board::Reward error = target - net.evaluate(b_next);
-        loss += std::abs(error);
-        target = reward - net.evaluate(b_next);
-      }
-      test_loss += loss / size;
-    }
     std::cout.precision(3);
-    std::cout << "Epoch " << epoch << " ( "
-              << Board::Reward(clock() - begin_time) / CLOCKS_PER_SEC
-              << " sec) || train loss: " << train_loss / train_set.size()
-              << " || test loss: " << test_loss / test_set.size() << std::endl;
+    std::cout << "Epoch " << epoch << " ( " << wall.count() << " sec, "
+              << threads << " threads) || train loss: " << train_loss
+              << " || test loss: " << test_loss(net, test_set) << std::endl;
+    if (parity && !stream_window) {
+      begin_time = std::chrono::steady_clock::now();
+      Board::Reward ref_loss = train_epoch(ref, train_set, lr, 1, 0);
+      wall = std::chrono::steady_clock::now() - begin_time;
+      std::cout << "  single-threaded ( " << wall.count()
+                << " sec) || train loss: " << ref_loss / train_set.size()
+                << " || test loss: " << test_loss(ref, test_set) << std::endl;
+    }
   }
   const std::string saved_path = "model/3_8_newNet.model";
   net.save(saved_path);
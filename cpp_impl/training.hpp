@@ -0,0 +1,227 @@
+#pragma once
+#include <algorithm>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "board.hpp"
+#include "aggregate.hpp"
+#include "episode.hpp"
+#include "episode_stream.hpp"
+#include "feature_cache.hpp"
+#include "replay_buffer.hpp"
+
+// The TD worker pool shared by the training loops. Each of `threads` workers
+// pulls episodes with `source(tid, train)`, which calls `train(episode)` and
+// returns false once the worker has nothing left, Hogwild style: workers
+// write the shared tables without locks and may lose the odd concurrent
+// update. With `sync > 0` each worker instead buffers its updates and
+// applies them every `sync` episodes, so the tables are read-mostly and
+// written in bursts. Returns the summed per-episode loss and the episode
+// count.
+template <class Net, class Source>
+std::tuple<Board::Reward, size_t> td_workers(Net& net, Source&& source,
+                                             Board::Reward lr, int threads,
+                                             int sync) {
+  std::vector<Board::Reward> losses(threads, 0);
+  std::vector<size_t> counts(threads, 0);
+  auto worker = [&](int tid) {
+    std::vector<Board> boards;
+    std::vector<Board::Reward> errors;
+    auto flush = [&] {
+      net.update_batch(boards, errors, lr);
+      boards.clear();
+      errors.clear();
+    };
+    auto train = [&](const auto& ep) {
+      if (sync > 0) {
+        losses[tid] += td_episode(net, ep,
+                                  [&](const Board& b, Board::Reward error) {
+                                    boards.push_back(b);
+                                    errors.push_back(error);
+                                  });
+        if (++counts[tid] % sync == 0) flush();
+      } else {
+        losses[tid] += td_episode(net, ep,
+                                  [&](const Board& b, Board::Reward error) {
+                                    net.update_net(b, error, lr);
+                                  });
+        ++counts[tid];
+      }
+    };
+    while (source(tid, train)) {
+    }
+    flush();
+  };
+  if (threads == 1) {
+    worker(0);
+  } else {
+    std::vector<std::thread> pool;
+    for (int tid = 0; tid < threads; tid++) pool.emplace_back(worker, tid);
+    for (auto& t : pool) t.join();
+  }
+  Board::Reward loss = 0;
+  size_t count = 0;
+  for (int tid = 0; tid < threads; tid++) {
+    loss += losses[tid];
+    count += counts[tid];
+  }
+  return {loss, count};
+}
+
+// One pass over `train_set` split into `threads` interleaved shards. Returns
+// the summed per-episode loss.
+template <class Net>
+Board::Reward train_epoch(Net& net, const EpisodeSet& train_set,
+                          Board::Reward lr, int threads, int sync) {
+  std::vector<size_t> cursors(threads);
+  for (int tid = 0; tid < threads; tid++) cursors[tid] = tid;
+  auto source = [&](int tid, auto&& train) {
+    size_t& i = cursors[tid];
+    if (i >= train_set.size()) return false;
+    train(train_set[i]);
+    i += threads;
+    return true;
+  };
+  return std::get<0>(td_workers(net, source, lr, threads, sync));
+}
+
+// One pass over a stream, each worker taking the next episode it hands out.
+// Returns the summed per-episode loss and the number of episodes.
+template <class Net>
+std::tuple<Board::Reward, size_t> train_stream(Net& net, EpisodeStream& stream,
+                                               Board::Reward lr, int threads,
+                                               int sync) {
+  std::vector<Episode> current(threads);
+  auto source = [&](int tid, auto&& train) {
+    if (!stream.next(current[tid])) return false;
+    train(current[tid]);
+    return true;
+  };
+  return td_workers(net, source, lr, threads, sync);
+}
+
+// `train_epoch` over the precomputed indices of a `FeatureCache`: the same
+// TD(0) walk as `td_episode`, reading and writing the tables through the
+// cached indices. Returns the summed per-episode loss.
+template <class Net>
+Board::Reward train_cached(Net& net, const FeatureCache<Net>& cache,
+                           Board::Reward lr, int threads, int sync) {
+  using Feats = typename Net::Feats;
+  std::vector<Board::Reward> losses(threads, 0);
+  auto worker = [&](int tid) {
+    std::vector<const Feats*> pending;
+    std::vector<Board::Reward> errors;
+    auto flush = [&] {
+      for (size_t j = 0; j < pending.size(); j++) {
+        net.update_feats(*pending[j], errors[j], lr);
+      }
+      pending.clear();
+      errors.clear();
+    };
+    auto update = [&](const Feats& f, Board::Reward error) {
+      if (sync > 0) {
+        pending.push_back(&f);
+        errors.push_back(error);
+      } else {
+        net.update_feats(f, error, lr);
+      }
+    };
+    int episodes = 0;
+    for (size_t i = tid; i < cache.size(); i += threads) {
+      const auto ep = cache[i];
+      Board::Reward target = 0;
+      Board::Reward loss = 0;
+      for (size_t t = ep.size(); t > 0; t--) {
+        const Feats& f = ep.feats[t];
+        Board::Reward error = target - net.evaluate_feats(f);
+        loss += std::abs(error);
+        update(f, error);
+        target = ep.rewards[t] - net.evaluate_feats(f);
+      }
+      update(ep.feats[0], target - net.evaluate_feats(ep.feats[0]));
+      losses[tid] += loss / ep.size();
+      if (sync > 0 && ++episodes % sync == 0) flush();
+    }
+    flush();
+  };
+  if (threads == 1) {
+    worker(0);
+  } else {
+    std::vector<std::thread> pool;
+    for (int tid = 0; tid < threads; tid++) pool.emplace_back(worker, tid);
+    for (auto& t : pool) t.join();
+  }
+  Board::Reward loss = 0;
+  for (auto l : losses) loss += l;
+  return loss;
+}
+
+// One pass over the positions of an `Aggregate` in `threads` interleaved
+// shards. Each position is updated once toward its mean TD target with the
+// error scaled by its count, the summed error of the duplicates it stands
+// for. A step moves the value by about 8 * lr * error (one weight per
+// feature), so the scale is capped at 0.1 / lr to keep that under the error
+// itself; positions seen more often than that are undertrained rather than
+// overshot. Returns the count-weighted mean loss per state.
+template <class Net>
+Board::Reward train_aggregate(Net& net, const Aggregate& data,
+                              Board::Reward lr, int threads, int sync) {
+  std::vector<double> losses(threads, 0);
+  const Board::Reward max_scale = std::max<Board::Reward>(1, 0.1 / lr);
+  auto worker = [&](int tid) {
+    std::vector<Board> boards;
+    std::vector<Board::Reward> errors;
+    int n = 0;
+    for (size_t i = tid; i < data.positions.size(); i += threads) {
+      const Position& p = data.positions[i];
+      const Board::Reward error = data.target(net, p) - net.evaluate(p.board);
+      losses[tid] += double(std::abs(error)) * p.count;
+      const Board::Reward scale = std::min<Board::Reward>(p.count, max_scale);
+      if (sync > 0) {
+        boards.push_back(p.board);
+        errors.push_back(error * scale);
+        if (++n % sync == 0) {
+          net.update_batch(boards, errors, lr);
+          boards.clear();
+          errors.clear();
+        }
+      } else {
+        net.update_net(p.board, error * scale, lr);
+      }
+    }
+    net.update_batch(boards, errors, lr);
+  };
+  if (threads == 1) {
+    worker(0);
+  } else {
+    std::vector<std::thread> pool;
+    for (int tid = 0; tid < threads; tid++) pool.emplace_back(worker, tid);
+    for (auto& t : pool) t.join();
+  }
+  double loss = 0;
+  for (auto l : losses) loss += l;
+  return data.states ? loss / data.states : 0;
+}
+
+template <class Net>
+Board::Reward test_loss(const Net& net, const EpisodeSet& test_set) {
+  Board::Reward total = 0;
+  // no updates here, so every state of an episode is evaluated in one batch,
+  // straight out of the buffer's step array
+  std::vector<Board::Reward> values;
+  for (const auto& ep : test_set) {
+    Board::Reward target = 0;
+    Board::Reward loss = 0;
+    const int size = ep.size();
+    values.resize(size);
+    net.evaluate_batch(ep.states(), values);
+    for (int t = size - 1; t >= 0; t--) {
+      Board::Reward error = target - values[t];
+      loss += std::abs(error);
+      target = ep.reward(t) - values[t];
+    }
+    total += loss / size;
+  }
+  return total / test_set.size();
+}